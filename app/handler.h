@@ -1,10 +1,9 @@
 #pragma once
 
-#include <tcp/server.h>
+#include <tcp/backend.h>
 
-#include <cstring>
-
-#include <arpa/inet.h>
+#include <span>
+#include <string_view>
 
 /**
  * Handler for echo server. Welcomes the client and echoes back the message.
@@ -12,53 +11,56 @@
  */
 class EchoHandler {
 public:
+    /// @brief Echoing is cheaper than a hop to the thread pool, so the
+    /// callbacks run on the reactor threads.
+    static constexpr bool inline_dispatch = true;
+
     /**
      * @brief Called when a new connection is established.
-     * @param addr The address of the new connection.
-     * @param out_buf The buffer to write the response to.
+     * @param conn The new connection.
+     * @param out The response to write to.
      * @return whether connection should continue.
      */
-    [[nodiscard]] static bool OnNew([[maybe_unused]] const sockaddr_in &addr, std::vector<std::byte> &out_buf) noexcept {
-        static const std::string msg = "Welcome to the echo server!";
-        out_buf.resize(msg.size());
-        std::transform(msg.begin(), msg.end(), out_buf.begin(), [](char c) { return std::byte(c); });
+    [[nodiscard]] static bool OnNew([[maybe_unused]] tcp::Connection<> &conn, tcp::Output &out) noexcept {
+        static constexpr std::string_view msg = "Welcome to the echo server!";
+        out.AddSlice(std::as_bytes(std::span(msg)));
 #ifdef DEBUG
-        std::cout << "New connection from " << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port) << std::endl;
+        std::cout << "New connection from " << conn.addr.ToString() << std::endl;
 #endif
         return true;
     }
 
     /**
      * @brief Called when a message is received.
-     * @param addr The address of the connection that sent the message.
-     * @param buf The message.
+     * @param conn The connection that sent the message.
+     * @param in The bytes received.
+     * @param out The response to write to.
      */
-    [[nodiscard]] static bool OnRead([[maybe_unused]] const sockaddr_in &addr, const std::vector<std::byte> &in_buf, std::vector<std::byte> &out_buf) noexcept {
-        const std::size_t len = std::strlen(reinterpret_cast<const char *>(in_buf.data()));
-        out_buf.resize(len);
-        std::copy(in_buf.begin(), in_buf.begin() + static_cast<long>(len), out_buf.begin());
+    [[nodiscard]] static bool OnRead([[maybe_unused]] tcp::Connection<> &conn, std::span<const std::byte> in, tcp::Output &out) noexcept {
+        out.Append(in);
 #ifdef DEBUG
-        std::cout << "Received '" << std::string(reinterpret_cast<const char *>(in_buf.data()), len) << "' from " << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port) << std::endl;
+        std::cout << "Received '" << std::string_view(reinterpret_cast<const char *>(in.data()), in.size()) << "' from " << conn.addr.ToString() << std::endl;
 #endif
         return true;
     }
 
+#ifdef DEBUG
     /**
-     * @brief Called when a connection is closed.
-     * @param addr The address of the closed connection.
+     * @brief Called when a connection is closed. Only declared in debug
+     * builds, so release builds dispatch nothing on close.
+     * @param conn The closed connection.
      */
-    static void OnClose([[maybe_unused]] const sockaddr_in &addr) noexcept {
-#ifdef DEBUG
-        std::cout << "Connection closed from " << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port) << std::endl;
-#endif 
+    static void OnClose(tcp::Connection<> &conn) noexcept {
+        std::cout << "Connection closed from " << conn.addr.ToString() << std::endl;
     }
+#endif
 
     /**
      * @brief Called when an error occurs.
-     * @param addr The address of the connection that caused the error.
+     * @param conn The connection that caused the error.
      * @param error The error.
     */
-    static void OnError(const sockaddr_in &addr, const tcp::Error &error) noexcept {
-        std::cout << "Error from " << inet_ntoa(addr.sin_addr) << ":" << ntohs(addr.sin_port) << ": " << error.what() << std::endl;
+    static void OnError(tcp::Connection<> &conn, const tcp::Error &error) noexcept {
+        std::cout << "Error from " << conn.addr.ToString() << ": " << error.what() << std::endl;
     }
 };
\ No newline at end of file
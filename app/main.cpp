@@ -10,7 +10,9 @@
 int main() {
     try {
         EchoHandler handler;
-        tcp::Server<EchoHandler> server(PORT, THREADS, BUFFER_SIZE, EVENTS);
+        // The handler runs inline, so every thread runs a reactor of its own
+        tcp::DefaultServer<EchoHandler> server(PORT, THREADS, BUFFER_SIZE, EVENTS,
+                                               tcp::Options{.reactor_per_thread = true});
         std::cout << "Starting server on port: " << PORT << std::endl;
         server.Run(handler);
     } catch (const tcp::Error &e) {
@@ -0,0 +1,478 @@
+#include <tcp/metrics.h>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/*
+ * Load generator for echo servers. Every thread drives its share of the
+ * connections from its own epoll instance, either closed loop, keeping a
+ * number of messages in flight per connection, or open loop, sending at a
+ * fixed rate whether the responses keep up or not. Open loop latencies are
+ * measured from when a message was due rather than from when it went out,
+ * so a stalled server cannot hide behind the client waiting for it.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Settings of a run, from the command line.
+ */
+struct Config {
+    std::string host = "127.0.0.1";
+    std::uint16_t port = 8080;
+    std::size_t connections = 64;
+    std::size_t threads = 1;
+    std::chrono::milliseconds duration{5000};
+    std::chrono::milliseconds warmup{1000};
+    std::size_t size = 64;
+    // closed loop: messages in flight per connection
+    std::size_t pipeline = 1;
+    // open loop: messages per second over all connections, zero for closed loop
+    double rate = 0;
+    // bytes the server sends on connect, discarded before measuring
+    std::size_t welcome = 27;
+};
+
+/**
+ * @brief Counters and latencies of a thread, or of all of them.
+ */
+struct Results {
+    std::uint64_t messages = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t errors = 0;
+    tcp::HistogramSnapshot latency;
+};
+
+/**
+ * @brief A connection to the server and its messages in flight.
+ */
+struct Conn {
+    int fd = -1;
+    // greeting bytes still to discard
+    std::size_t welcome = 0;
+    // bytes of the oldest message in flight received so far
+    std::size_t received = 0;
+    // bytes of the queued messages not written yet
+    std::size_t unwritten = 0;
+    // when each message in flight was due, oldest first
+    std::deque<Clock::time_point> sent;
+    // open loop: when the next message is due
+    Clock::time_point next_due;
+    // whether the socket is registered for EPOLLOUT
+    bool want_write = false;
+};
+
+/**
+ * @brief Prints the usage and exits.
+ * @param name The name of the program.
+ */
+[[noreturn]] static void Usage(const char *name) {
+    std::cerr << "usage: " << name << " [options]\n"
+              << "  --host ADDR         server address (127.0.0.1)\n"
+              << "  --port PORT         server port (8080)\n"
+              << "  --connections N     connections to open (64)\n"
+              << "  --threads N         client threads (1)\n"
+              << "  --duration SECONDS  measured time (5)\n"
+              << "  --warmup SECONDS    unmeasured time before it (1)\n"
+              << "  --size BYTES        message size (64)\n"
+              << "  --pipeline N        closed loop: messages in flight per connection (1)\n"
+              << "  --rate N            open loop: messages per second in total (off)\n"
+              << "  --welcome BYTES     greeting sent by the server on connect (27)\n";
+    std::exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Parses the command line, exiting on invalid arguments.
+ * @return The settings.
+ */
+static Config ParseArgs(int argc, char **argv) {
+    Config config;
+    try {
+        for (int i = 1; i < argc; i += 2) {
+            const std::string_view arg = argv[i];
+            if (i + 1 >= argc) {
+                Usage(argv[0]);
+            }
+            const std::string value = argv[i + 1];
+            const auto seconds = [&value] {
+                return std::chrono::milliseconds(static_cast<std::int64_t>(std::stod(value) * 1000));
+            };
+            if (arg == "--host") {
+                config.host = value;
+            } else if (arg == "--port") {
+                config.port = static_cast<std::uint16_t>(std::stoul(value));
+            } else if (arg == "--connections") {
+                config.connections = std::stoul(value);
+            } else if (arg == "--threads") {
+                config.threads = std::stoul(value);
+            } else if (arg == "--duration") {
+                config.duration = seconds();
+            } else if (arg == "--warmup") {
+                config.warmup = seconds();
+            } else if (arg == "--size") {
+                config.size = std::stoul(value);
+            } else if (arg == "--pipeline") {
+                config.pipeline = std::stoul(value);
+            } else if (arg == "--rate") {
+                config.rate = std::stod(value);
+            } else if (arg == "--welcome") {
+                config.welcome = std::stoul(value);
+            } else {
+                Usage(argv[0]);
+            }
+        }
+    } catch (const std::logic_error &) {
+        Usage(argv[0]);
+    }
+    if (config.connections == 0 || config.threads == 0 || config.size == 0 || config.pipeline == 0 ||
+        config.rate < 0) {
+        Usage(argv[0]);
+    }
+    config.threads = std::min(config.threads, config.connections);
+    return config;
+}
+
+/**
+ * @brief Drives the connections of one thread until the end of the run.
+ */
+class Worker {
+public:
+    /**
+     * @brief Creates a worker, without connecting yet.
+     * @param config The settings of the run.
+     * @param connections The number of connections of the worker.
+     * @param start When measuring starts, after the warm up.
+     * @param end When the run ends.
+     */
+    Worker(const Config &config, std::size_t connections, Clock::time_point start, Clock::time_point end)
+            : config_(config), conns_(connections), start_(start), end_(end),
+              payload_(config.size, std::byte{'x'}), scratch_(64 * 1024) {
+        // spread the open loop rate over every connection
+        if (config.rate > 0) {
+            const double per_conn = config.rate / static_cast<double>(config.connections);
+            interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / per_conn));
+            interval_ = std::max(interval_, Clock::duration{1});
+        }
+    }
+
+    Worker(const Worker &) = delete;
+    Worker &operator=(const Worker &) = delete;
+
+    ~Worker() {
+        for (const Conn &conn: conns_) {
+            if (conn.fd != -1) {
+                close(conn.fd);
+            }
+        }
+        if (epoll_fd_ != -1) {
+            close(epoll_fd_);
+        }
+    }
+
+    /**
+     * @brief Connects to the server, from the thread that runs the worker.
+     */
+    void Connect() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ == -1) {
+            throw std::runtime_error("epoll_create1 failed");
+        }
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config_.port);
+        if (inet_pton(AF_INET, config_.host.c_str(), &addr.sin_addr) != 1) {
+            throw std::runtime_error("invalid address " + config_.host);
+        }
+
+        for (std::size_t i = 0; i < conns_.size(); ++i) {
+            // connect blocking, then switch to non-blocking
+            Conn &conn = conns_[i];
+            conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (conn.fd == -1 || connect(conn.fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1) {
+                throw std::runtime_error(std::string("connect failed: ") + std::strerror(errno));
+            }
+            const int opt = 1;
+            setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            fcntl(conn.fd, F_SETFL, fcntl(conn.fd, F_GETFL) | O_NONBLOCK);
+            conn.welcome = config_.welcome;
+
+            // stagger the open loop connections over one interval
+            conn.next_due = Clock::now() + interval_ * static_cast<std::int64_t>(i) / static_cast<std::int64_t>(conns_.size());
+
+            epoll_event event = {.events = EPOLLIN, .data = {.u64 = i}};
+            if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn.fd, &event) == -1) {
+                throw std::runtime_error("epoll_ctl failed");
+            }
+            if (config_.welcome == 0) {
+                Start(conn);
+            }
+        }
+    }
+
+    /**
+     * @brief Runs the traffic until the end of the run.
+     */
+    void Run() {
+        std::vector<epoll_event> events(conns_.size());
+        for (Clock::time_point now = Clock::now(); now < end_; now = Clock::now()) {
+            // send whatever is due, then wait for responses or the next due time
+            const Clock::time_point wake = interval_ == Clock::duration::zero() ? end_ : SendDue(now);
+            const timespec timeout = TimeoutUntil(wake);
+            const int num_events = epoll_pwait2(epoll_fd_, events.data(), static_cast<int>(events.size()), &timeout, nullptr);
+            if (num_events == -1 && errno != EINTR) {
+                throw std::runtime_error("epoll_wait failed");
+            }
+            for (int i = 0; i < num_events; ++i) {
+                Conn &conn = conns_[events[i].data.u64];
+                if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+                    Receive(conn);
+                }
+                if ((events[i].events & EPOLLOUT) && conn.fd != -1) {
+                    Flush(conn);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Adds the results of the worker to the totals.
+     * @param results The totals.
+     */
+    void MergeInto(Results &results) const {
+        results.messages += messages_;
+        results.bytes += messages_ * payload_.size();
+        results.errors += errors_;
+        latency_.MergeInto(results.latency);
+    }
+
+private:
+    // starts the traffic of a connection once its greeting is in
+    void Start(Conn &conn) {
+        if (interval_ == Clock::duration::zero()) {
+            for (std::size_t i = 0; i < config_.pipeline; ++i) {
+                Queue(conn, Clock::now());
+            }
+            Flush(conn);
+        }
+    }
+
+    // open loop: sends the messages due by now, late or not, and returns when
+    // the next one is due
+    Clock::time_point SendDue(Clock::time_point now) {
+        Clock::time_point wake = end_;
+        for (Conn &conn: conns_) {
+            if (conn.fd == -1 || conn.welcome > 0) {
+                continue;
+            }
+            const std::size_t before = conn.unwritten;
+            while (conn.next_due <= now) {
+                Queue(conn, conn.next_due);
+                conn.next_due += interval_;
+            }
+            wake = std::min(wake, conn.next_due);
+            if (conn.unwritten > before && !conn.want_write) {
+                Flush(conn);
+            }
+        }
+        return wake;
+    }
+
+    void Queue(Conn &conn, Clock::time_point due) {
+        conn.sent.push_back(due);
+        conn.unwritten += payload_.size();
+    }
+
+    void Flush(Conn &conn) {
+        // every message is the same payload, write from where the oldest
+        // unwritten one is at
+        while (conn.unwritten > 0) {
+            const std::size_t offset = (payload_.size() - conn.unwritten % payload_.size()) % payload_.size();
+            const ssize_t n = send(conn.fd, payload_.data() + offset, payload_.size() - offset, MSG_NOSIGNAL);
+            if (n > 0) {
+                conn.unwritten -= static_cast<std::size_t>(n);
+            } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (n == -1 && errno == EINTR) {
+                continue;
+            } else {
+                return Fail(conn);
+            }
+        }
+
+        // wait for room only while something is left
+        const bool want_write = conn.unwritten > 0;
+        if (want_write != conn.want_write) {
+            epoll_event event = {.events = EPOLLIN | (want_write ? static_cast<std::uint32_t>(EPOLLOUT) : 0u),
+                                 .data = {.u64 = static_cast<std::uint64_t>(&conn - conns_.data())}};
+            epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn.fd, &event);
+            conn.want_write = want_write;
+        }
+    }
+
+    void Receive(Conn &conn) {
+        while (conn.fd != -1) {
+            const ssize_t n = recv(conn.fd, scratch_.data(), scratch_.size(), 0);
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            } else if (n == -1 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                return Fail(conn);
+            }
+
+            // discard the greeting, then complete the messages in order
+            auto left = static_cast<std::size_t>(n);
+            const std::size_t skipped = std::min(left, conn.welcome);
+            conn.welcome -= skipped;
+            left -= skipped;
+            if (skipped > 0 && conn.welcome == 0) {
+                Start(conn);
+            }
+
+            const Clock::time_point now = Clock::now();
+            std::size_t completed = 0;
+            while (left > 0 && !conn.sent.empty()) {
+                const std::size_t take = std::min(left, payload_.size() - conn.received);
+                conn.received += take;
+                left -= take;
+                if (conn.received == payload_.size()) {
+                    Complete(conn.sent.front(), now);
+                    conn.sent.pop_front();
+                    conn.received = 0;
+                    ++completed;
+                }
+            }
+            if (left > 0) {
+                ++errors_;  // more than was sent
+                return Fail(conn);
+            }
+
+            // closed loop: keep the pipeline full
+            if (interval_ == Clock::duration::zero() && completed > 0) {
+                for (std::size_t i = 0; i < completed; ++i) {
+                    Queue(conn, now);
+                }
+                if (!conn.want_write) {
+                    Flush(conn);
+                }
+            }
+        }
+    }
+
+    void Complete(Clock::time_point due, Clock::time_point now) {
+        // only count what was due after the warm up
+        if (due < start_) {
+            return;
+        }
+        ++messages_;
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+        latency_.Record(static_cast<std::uint64_t>(std::max<std::int64_t>(ns, 0)));
+    }
+
+    void Fail(Conn &conn) {
+        ++errors_;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn.fd, nullptr);
+        close(conn.fd);
+        conn.fd = -1;
+    }
+
+    // epoll_wait only sleeps in milliseconds, which would make every open
+    // loop message late by up to one
+    static timespec TimeoutUntil(Clock::time_point wake) {
+        const auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(wake - Clock::now()).count();
+        const std::int64_t ns = std::clamp<std::int64_t>(delay, 0, 100'000'000);
+        return {.tv_sec = 0, .tv_nsec = static_cast<long>(ns)};
+    }
+
+    const Config &config_;
+    std::vector<Conn> conns_;
+    Clock::time_point start_;
+    Clock::time_point end_;
+    Clock::duration interval_{Clock::duration::zero()};
+    std::vector<std::byte> payload_;
+    std::vector<std::byte> scratch_;
+    int epoll_fd_ = -1;
+    std::uint64_t messages_ = 0;
+    std::uint64_t errors_ = 0;
+    tcp::Histogram latency_;
+};
+
+int main(int argc, char **argv) {
+    const Config config = ParseArgs(argc, argv);
+
+    // measuring starts once every thread is connected and warmed up
+    const Clock::time_point start = Clock::now() + std::chrono::milliseconds(200) + config.warmup;
+    const Clock::time_point end = start + config.duration;
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (std::size_t i = 0; i < config.threads; ++i) {
+        const std::size_t share = config.connections / config.threads + (i < config.connections % config.threads);
+        workers.push_back(std::make_unique<Worker>(config, share, start, end));
+    }
+
+    std::vector<std::thread> threads;
+    bool failed = false;
+    std::vector<std::string> errors(workers.size());
+    for (std::size_t i = 0; i < workers.size(); ++i) {
+        threads.emplace_back([&worker = *workers[i], &error = errors[i]] {
+            try {
+                worker.Connect();
+                worker.Run();
+            } catch (const std::exception &e) {
+                error = e.what();
+            }
+        });
+    }
+    for (std::size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        if (!errors[i].empty()) {
+            std::cerr << "thread " << i << ": " << errors[i] << std::endl;
+            failed = true;
+        }
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    // report the totals
+    Results results;
+    for (const auto &worker: workers) {
+        worker->MergeInto(results);
+    }
+    const double seconds = std::chrono::duration<double>(config.duration).count();
+    const auto us = [&results](double percentile) { return static_cast<double>(results.latency.Percentile(percentile)) / 1000.0; };
+    std::printf("%s loop, %zu connections, %zu threads, %zu byte messages",
+                config.rate > 0 ? "open" : "closed", config.connections, config.threads, config.size);
+    if (config.rate > 0) {
+        std::printf(", %.0f msg/s target\n", config.rate);
+    } else {
+        std::printf(", pipeline %zu\n", config.pipeline);
+    }
+    std::printf("throughput: %.0f msg/s, %.2f MB/s, %llu errors\n", static_cast<double>(results.messages) / seconds,
+                static_cast<double>(results.bytes) / seconds / 1e6, static_cast<unsigned long long>(results.errors));
+    std::printf("latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, mean %.1f\n", us(50), us(99), us(99.9),
+                static_cast<double>(results.latency.Max()) / 1000.0, results.latency.Mean() / 1000.0);
+    return results.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
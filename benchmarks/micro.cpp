@@ -0,0 +1,358 @@
+#include <tcp/buffer_pool.h>
+#include <tcp/metrics.h>
+#include <tcp/server.h>
+#include <tcp/thread_pool.h>
+
+#include <benchmark/benchmark.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Microbenchmarks of the paths every request goes through: handing a task to
+ * the thread pool and running it, dispatching an update to a handler, and
+ * borrowing buffers. Every pool benchmark runs per queue, worker count and
+ * producer count, so pool settings can be picked from the numbers.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr std::array kQueues = {ThreadPool::Queue::Locked, ThreadPool::Queue::LockFree, ThreadPool::Queue::Affinity,
+                                ThreadPool::Queue::WorkStealing};
+constexpr std::array kQueueNames = {"locked", "lockfree", "affinity", "stealing"};
+
+/// @brief How a task gets to the pool.
+enum class Submit {
+    /// @brief Post with a capture small enough to be stored in the task.
+    Inline,
+    /// @brief Post with a capture too large for the task, stored on the heap.
+    Heap,
+    /// @brief Push, with a packaged task and a future per task.
+    Future,
+};
+constexpr std::array kSubmitNames = {"inline", "heap", "future"};
+
+/// @brief Tasks posted per iteration over all producers.
+constexpr std::size_t kBatch = 16 * 1024;
+/// @brief Keys the tasks are posted with, like as many connections.
+constexpr std::size_t kKeys = 64;
+
+/**
+ * @brief What a worker saw, on its own cache line.
+ */
+struct alignas(tcp::kCacheLineSize) WorkerStats {
+    /// @brief Tasks run.
+    tcp::Counter done;
+    /// @brief From posting a task to running it, in nanoseconds.
+    tcp::Histogram latency;
+};
+
+/**
+ * @brief Posts tasks from a number of producers, and runs them on the pool.
+ */
+class PoolBench {
+public:
+    /**
+     * @brief Creates the pool.
+     * @param queue The queue of the pool.
+     * @param workers The number of workers.
+     */
+    PoolBench(ThreadPool::Queue queue, std::size_t workers)
+            : pool_(workers, queue, kBatch), stats_(std::make_unique<WorkerStats[]>(workers)) {}
+
+    /**
+     * @brief Posts a batch of tasks and waits for all of them to run.
+     * @param producers The number of threads posting, the calling one included.
+     * @param submit How the tasks are posted.
+     */
+    void RunBatch(std::size_t producers, Submit submit) {
+        const std::uint64_t target = Done() + kBatch;
+
+        // the calling thread is the last producer
+        std::vector<std::thread> threads;
+        for (std::size_t p = 1; p < producers; ++p) {
+            threads.emplace_back([this, p, producers, submit] { Produce(p, producers, submit); });
+        }
+        Produce(0, producers, submit);
+        for (std::thread &thread: threads) {
+            thread.join();
+        }
+        while (Done() < target) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief Reports the latencies of every task run so far.
+     * @param state The state of the benchmark.
+     */
+    void Report(benchmark::State &state) const {
+        tcp::HistogramSnapshot latency;
+        for (std::size_t i = 0; i < pool_.Size(); ++i) {
+            stats_[i].latency.MergeInto(latency);
+        }
+        state.counters["p50_ns"] = static_cast<double>(latency.Percentile(50));
+        state.counters["p99_ns"] = static_cast<double>(latency.Percentile(99));
+        state.counters["mean_ns"] = latency.Mean();
+    }
+
+private:
+    void Produce(std::size_t producer, std::size_t producers, Submit submit) {
+        for (std::size_t i = producer; i < kBatch; i += producers) {
+            const Clock::time_point posted = Clock::now();
+            switch (submit) {
+                case Submit::Inline:
+                    pool_.Post(i % kKeys, [this, posted] { Ran(posted); });
+                    break;
+                case Submit::Heap:
+                    pool_.Post(i % kKeys, [this, posted, padding = std::array<std::byte, 128>{}] {
+                        benchmark::DoNotOptimize(padding);
+                        Ran(posted);
+                    });
+                    break;
+                case Submit::Future:
+                    static_cast<void>(pool_.Push([this, posted] { Ran(posted); }));
+                    break;
+            }
+        }
+    }
+
+    void Ran(Clock::time_point posted) noexcept {
+        WorkerStats &stats = stats_[ThreadPool::CurrentWorker()];
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - posted).count();
+        stats.latency.Record(static_cast<std::uint64_t>(ns));
+        stats.done.Add();
+    }
+
+    [[nodiscard]] std::uint64_t Done() const noexcept {
+        std::uint64_t done = 0;
+        for (std::size_t i = 0; i < pool_.Size(); ++i) {
+            done += stats_[i].done.Load();
+        }
+        return done;
+    }
+
+    ThreadPool pool_;
+    std::unique_ptr<WorkerStats[]> stats_;
+};
+
+/**
+ * @brief Post or Push to run, by queue, workers, producers and submission:
+ * tasks/s and the latency from posting a task to running it.
+ */
+void BM_PoolDispatch(benchmark::State &state) {
+    const auto queue = static_cast<std::size_t>(state.range(0));
+    const auto workers = static_cast<std::size_t>(state.range(1));
+    const auto producers = static_cast<std::size_t>(state.range(2));
+    const auto submit = static_cast<Submit>(state.range(3));
+    state.SetLabel(std::string(kQueueNames[queue]) + "/" + kSubmitNames[state.range(3)]);
+
+    PoolBench bench(kQueues[queue], workers);
+    for (auto _: state) {
+        bench.RunBatch(producers, submit);
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * kBatch));
+    bench.Report(state);
+}
+
+void PoolArgs(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"queue", "workers", "producers", "submit"});
+    for (std::int64_t queue = 0; queue < static_cast<std::int64_t>(kQueues.size()); ++queue) {
+        for (const std::int64_t workers: {1, 2, 4}) {
+            for (const std::int64_t producers: {1, 4}) {
+                bench->Args({queue, workers, producers, static_cast<std::int64_t>(Submit::Inline)});
+            }
+        }
+        // what the allocation of the task costs, on a single setting
+        bench->Args({queue, 2, 1, static_cast<std::int64_t>(Submit::Heap)});
+        bench->Args({queue, 2, 1, static_cast<std::int64_t>(Submit::Future)});
+    }
+}
+
+BENCHMARK(BM_PoolDispatch)->Apply(PoolArgs)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+/**
+ * @brief Echo handler running its callbacks on the thread pool.
+ */
+struct PoolEcho {
+    [[nodiscard]] static bool OnNew([[maybe_unused]] tcp::Connection<> &conn, [[maybe_unused]] tcp::Output &out) noexcept {
+        return true;
+    }
+
+    [[nodiscard]] static bool OnRead([[maybe_unused]] tcp::Connection<> &conn, std::span<const std::byte> in, tcp::Output &out) noexcept {
+        out.Append(in);
+        return true;
+    }
+
+    static void OnClose([[maybe_unused]] tcp::Connection<> &conn) noexcept {}
+
+    static void OnError([[maybe_unused]] tcp::Connection<> &conn, [[maybe_unused]] const tcp::Error &error) noexcept {}
+};
+
+/**
+ * @brief Echo handler running its callbacks on the reactor.
+ */
+struct InlineEcho : PoolEcho {
+    static constexpr bool inline_dispatch = true;
+};
+
+/// @brief First port the echo servers listen on, one per setting.
+constexpr std::uint16_t kBasePort = 18090;
+
+/**
+ * @brief Starts an echo server on a thread of its own, for the rest of the
+ * process.
+ * @param port The port to listen on.
+ * @param queue The queue of the server's pool.
+ */
+template <typename Handler>
+void StartServer(std::uint16_t port, ThreadPool::Queue queue) {
+    tcp::Options options;
+    options.task_queue = queue;
+    auto *server = new tcp::Server<Handler>(port, 2, 1024, 64, options);
+    std::thread([server] {
+        Handler handler;
+        server->Run(handler);
+    }).detach();
+}
+
+/**
+ * @brief Connects to a local server.
+ * @param port The port of the server.
+ * @return The socket, or -1 if the server cannot be reached.
+ */
+int ConnectTo(std::uint16_t port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0) {
+            const int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            return fd;
+        }
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+/**
+ * @brief Round trips of a message through a server's reactor, its dispatch
+ * to the handler and back, by queue or inline.
+ */
+void BM_HandlerDispatch(benchmark::State &state) {
+    // the last setting dispatches inline
+    const auto setting = static_cast<std::size_t>(state.range(0));
+    const auto port = static_cast<std::uint16_t>(kBasePort + setting);
+    state.SetLabel(setting < kQueues.size() ? kQueueNames[setting] : "inline");
+
+    // servers outlive their benchmark, start each one once
+    static std::array<bool, kQueues.size() + 1> started{};
+    if (!started[setting]) {
+        try {
+            if (setting < kQueues.size()) {
+                StartServer<PoolEcho>(port, kQueues[setting]);
+            } else {
+                StartServer<InlineEcho>(port, ThreadPool::Queue::Locked);
+            }
+        } catch (const tcp::Error &e) {
+            state.SkipWithError(e.what());
+            return;
+        }
+        started[setting] = true;
+    }
+    const int fd = ConnectTo(port);
+    if (fd == -1) {
+        state.SkipWithError("cannot connect to the server");
+        return;
+    }
+
+    std::array<std::byte, 64> message{};
+    std::array<std::byte, 64> response{};
+    for (auto _: state) {
+        send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+        for (std::size_t received = 0; received < response.size();) {
+            const ssize_t n = recv(fd, response.data() + received, response.size() - received, 0);
+            if (n <= 0) {
+                state.SkipWithError("connection lost");
+                close(fd);
+                return;
+            }
+            received += static_cast<std::size_t>(n);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    close(fd);
+}
+
+BENCHMARK(BM_HandlerDispatch)->DenseRange(0, kQueues.size())->UseRealTime();
+
+/// @brief Size of the buffers, the receive size the server usually runs with.
+constexpr std::size_t kBufSize = 1024;
+
+/**
+ * @brief Borrowing a sized receive buffer from a pool and returning it, from
+ * any number of threads sharing the pool.
+ */
+void BM_BufferPoolSized(benchmark::State &state) {
+    static tcp::BufferPool pool(kBufSize);
+    for (auto _: state) {
+        tcp::BufferPool::Buffer buf = pool.AcquireSized();
+        benchmark::DoNotOptimize(buf->data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_BufferPoolSized)->ThreadRange(1, 4)->UseRealTime();
+
+/**
+ * @brief Borrowing an empty send buffer, filling it and returning it.
+ */
+void BM_BufferPoolEmpty(benchmark::State &state) {
+    static tcp::BufferPool pool(kBufSize);
+    const std::vector<std::byte> payload(static_cast<std::size_t>(state.range(0)));
+    for (auto _: state) {
+        tcp::BufferPool::Buffer buf = pool.AcquireEmpty();
+        buf->insert(buf->end(), payload.begin(), payload.end());
+        benchmark::DoNotOptimize(buf->data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_BufferPoolEmpty)->Arg(64)->Arg(kBufSize);
+
+/**
+ * @brief The baseline the pool saves: allocating and zero-filling a buffer
+ * for every use.
+ */
+void BM_BufferAllocate(benchmark::State &state) {
+    for (auto _: state) {
+        std::vector<std::byte> buf(kBufSize);
+        benchmark::DoNotOptimize(buf.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_BufferAllocate)->ThreadRange(1, 4)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "utils.h"
+
+namespace tcp {
+
+/**
+ * @brief Socket address of any family the server listens on: IPv4, IPv6 or
+ * Unix domain.
+ *
+ * Unix domain paths starting with '@' name a socket in the abstract
+ * namespace, which leaves no file behind.
+ */
+class Address {
+ public:
+  /**
+   * @brief Creates an empty address.
+   */
+  Address() noexcept = default;
+
+  /**
+   * @brief Copies an address reported by the kernel.
+   * @param addr The address.
+   * @param size The size of the address.
+   */
+  [[nodiscard]] Address(const sockaddr *addr, const socklen_t size) noexcept
+      : _size(size < sizeof(_storage) ? size : sizeof(_storage)) {
+    std::memcpy(&_storage, addr, _size);
+  }
+
+  /**
+   * @brief Creates an IPv4 address.
+   * @param port The port.
+   * @param host The numeric host, empty for every interface.
+   * @return The address.
+   */
+  [[nodiscard]] static Address Ipv4(const std::uint16_t port, const std::string &host = {}) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET, addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (!host.empty() && inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+      throw Error("Invalid IPv4 address.", Error::Kind::SocketBinding);
+    }
+    return {reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)};
+  }
+
+  /**
+   * @brief Creates an IPv6 address. Bound to every interface it takes IPv4
+   * connections too, unless Options::v6_only is set.
+   * @param port The port.
+   * @param host The numeric host, empty for every interface.
+   * @return The address.
+   */
+  [[nodiscard]] static Address Ipv6(const std::uint16_t port, const std::string &host = {}) {
+    sockaddr_in6 addr{};
+    addr.sin6_family = AF_INET6, addr.sin6_port = htons(port);
+    addr.sin6_addr = in6addr_any;
+    if (!host.empty() && inet_pton(AF_INET6, host.c_str(), &addr.sin6_addr) != 1) {
+      throw Error("Invalid IPv6 address.", Error::Kind::SocketBinding);
+    }
+    return {reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)};
+  }
+
+  /**
+   * @brief Creates a Unix domain address.
+   * @param path The socket path, or its name in the abstract namespace after
+   * a '@'.
+   * @return The address.
+   */
+  [[nodiscard]] static Address Unix(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      throw Error("Invalid Unix domain socket path.", Error::Kind::SocketBinding);
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    if (path.front() == '@') {
+      addr.sun_path[0] = '\0';
+    }
+    return {reinterpret_cast<const sockaddr *>(&addr),
+            static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + (path.front() == '@' ? 0 : 1))};
+  }
+
+  /**
+   * @brief Returns the address family.
+   * @return AF_INET, AF_INET6, AF_UNIX, or AF_UNSPEC when empty.
+   */
+  [[nodiscard]] int Family() const noexcept { return _size == 0 ? AF_UNSPEC : _storage.ss_family; }
+
+  /**
+   * @brief Returns the address, for the socket calls.
+   * @return The address.
+   */
+  [[nodiscard]] const sockaddr *Data() const noexcept { return reinterpret_cast<const sockaddr *>(&_storage); }
+
+  /**
+   * @brief Returns the size of the address.
+   * @return The size.
+   */
+  [[nodiscard]] socklen_t Size() const noexcept { return _size; }
+
+  /**
+   * @brief Returns the port of an IP address.
+   * @return The port, zero for Unix domain addresses.
+   */
+  [[nodiscard]] std::uint16_t Port() const noexcept {
+    switch (Family()) {
+      case AF_INET:
+        return ntohs(reinterpret_cast<const sockaddr_in *>(&_storage)->sin_port);
+      case AF_INET6:
+        return ntohs(reinterpret_cast<const sockaddr_in6 *>(&_storage)->sin6_port);
+      default:
+        return 0;
+    }
+  }
+
+  /**
+   * @brief Returns the socket path of a Unix domain address.
+   * @return The path, '@' first in the abstract namespace, empty for
+   * unnamed sockets and IP addresses.
+   */
+  [[nodiscard]] std::string Path() const {
+    const auto *addr = reinterpret_cast<const sockaddr_un *>(&_storage);
+    const std::size_t header = offsetof(sockaddr_un, sun_path);
+    if (Family() != AF_UNIX || _size <= header) {
+      return {};
+    }
+    std::string path(addr->sun_path, _size - header);
+    if (path.front() == '\0') {
+      path.front() = '@';
+    } else {
+      path.resize(std::strlen(path.c_str()));
+    }
+    return path;
+  }
+
+  /**
+   * @brief Formats the address, as host:port, [host]:port, or unix:path.
+   * @return The text.
+   */
+  [[nodiscard]] std::string ToString() const {
+    // Appended piece by piece, GCC 12 sees overlaps in chained operator+
+    char host[INET6_ADDRSTRLEN] = {};
+    std::string text;
+    text.reserve(sizeof(host) + 8);
+    switch (Family()) {
+      case AF_INET:
+        inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&_storage)->sin_addr, host, sizeof(host));
+        text.append(host);
+        break;
+      case AF_INET6:
+        inet_ntop(AF_INET6, &reinterpret_cast<const sockaddr_in6 *>(&_storage)->sin6_addr, host, sizeof(host));
+        text += '[';
+        text.append(host);
+        text += ']';
+        break;
+      case AF_UNIX:
+        text.append("unix:");
+        text.append(Path());
+        return text;
+      default:
+        return text;
+    }
+    text += ':';
+    text.append(std::to_string(Port()));
+    return text;
+  }
+
+ private:
+  /// @brief The address, of whichever family.
+  sockaddr_storage _storage{};
+  /// @brief The size of the address.
+  socklen_t _size{0};
+};
+
+/**
+ * @brief Gets the client address.
+ * @param client_fd The client socket.
+ * @return The address.
+ */
+[[nodiscard]] inline Address GetClientAddress(int client_fd) {
+  sockaddr_storage client_addr{};
+  socklen_t client_addr_len = sizeof(client_addr);
+  if (getpeername(client_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len) == -1) {
+    throw Error("Failed to get client address.", Error::Kind::GetAddress);
+  }
+  return {reinterpret_cast<const sockaddr *>(&client_addr), client_addr_len};
+}
+
+/**
+ * @brief Binds a Unix domain socket, taking the path over from a socket file
+ * nobody listens on anymore.
+ * @param server_fd The socket.
+ * @param addr The address.
+ * @return Whether the socket was bound.
+ */
+[[nodiscard]] inline bool BindUnix(const int server_fd, const Address &addr) noexcept {
+  if (bind(server_fd, addr.Data(), addr.Size()) == 0) {
+    return true;
+  } else if (errno != EADDRINUSE || addr.Path().front() == '@') {
+    return false;
+  }
+
+  // Check if a server still answers on the path, before removing its file
+  const int probe_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe_fd == -1) {
+    return false;
+  }
+  const bool stale = connect(probe_fd, addr.Data(), addr.Size()) == -1 && errno == ECONNREFUSED;
+  close(probe_fd);
+  return stale && unlink(addr.Path().c_str()) == 0 && bind(server_fd, addr.Data(), addr.Size()) == 0;
+}
+
+/**
+ * @brief Opens a non-blocking server socket bound to an address.
+ * @param addr The address.
+ * @param reuse_port Whether other sockets may bind the same IP address,
+ * letting the kernel spread the incoming connections over them.
+ * @param v6_only Whether an IPv6 socket refuses IPv4 connections.
+ * @return The server socket, not listening yet.
+ */
+[[nodiscard]] inline int OpenServerSocket(const Address &addr, bool reuse_port, bool v6_only = false) {
+  const int server_fd = socket(addr.Family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+  // Check if the server socket was created successfully
+  if (server_fd == -1) {
+    throw Error("Failed to create server socket.", Error::Kind::SocketCreation);
+  }
+
+  try {
+    // Unix domain sockets have no port to share, nor addresses to reuse
+    if (addr.Family() == AF_UNIX) {
+      if (!BindUnix(server_fd, addr)) {
+        throw Error("Failed to bind server socket.", Error::Kind::SocketBinding);
+      }
+      return server_fd;
+    }
+
+    // Set socket options
+    const int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+      throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+    }
+
+    // Let every reactor bind its own socket to the same port
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
+      throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+    }
+
+    // Take IPv4 connections on IPv6 sockets too, unless told otherwise
+    const int v6 = v6_only ? 1 : 0;
+    if (addr.Family() == AF_INET6 && setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6, sizeof(v6)) == -1) {
+      throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+    }
+
+    // Bind the socket to an address and port
+    if (bind(server_fd, addr.Data(), addr.Size()) == -1) {
+      throw Error("Failed to bind server socket.", Error::Kind::SocketBinding);
+    }
+  } catch (const Error &) {
+    close(server_fd);
+    throw;
+  }
+
+  return server_fd;
+}
+
+}  // namespace tcp
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "framing.h"
+
+#ifdef TCP_IO_URING
+#include "uring_server.h"
+#else
+#include "server.h"
+#endif
+
+namespace tcp {
+
+/**
+ * @brief The server backend picked at compile time: UringServer when
+ * TCP_IO_URING is defined, the epoll based Server otherwise. Both run,
+ * stop and report metrics the same way.
+ * @tparam Handler The handler type.
+ * @tparam Framing The framing policy.
+ */
+template <typename Handler, typename Framing = RawFraming>
+#ifdef TCP_IO_URING
+using DefaultServer = UringServer<Handler, Framing>;
+#else
+using DefaultServer = Server<Handler, Framing>;
+#endif
+
+}  // namespace tcp
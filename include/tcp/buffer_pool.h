@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+
+/**
+ * @brief Pool of recycled byte buffers shared by the reactors and the worker
+ * threads.
+ *
+ * Buffers keep their capacity while they sit in the pool, so once the pool
+ * is warm acquiring a buffer neither allocates nor zero-fills memory. A
+ * borrowed buffer is a single pointer, which keeps the tasks carrying one
+ * small enough to be stored in place.
+ */
+class BufferPool {
+  /// @brief A pooled buffer and the pool it belongs to.
+  struct Node {
+    /// @brief The pool the buffer goes back to.
+    BufferPool *pool;
+    /// @brief The bytes.
+    std::vector<std::byte> bytes;
+  };
+
+ public:
+  /// @brief A buffer borrowed from the pool, returned to it on destruction.
+  class Buffer {
+   public:
+    /**
+     * @brief Creates an empty handle that does not belong to any pool.
+     */
+    Buffer() noexcept = default;
+
+    /**
+     * @brief Takes over the buffer of another handle.
+     * @param other The handle to take the buffer from.
+     */
+    Buffer(Buffer &&other) noexcept : _node(std::exchange(other._node, nullptr)) {}
+
+    /**
+     * @brief Returns the current buffer and takes over the one of another
+     * handle.
+     * @param other The handle to take the buffer from.
+     * @return This handle.
+     */
+    Buffer &operator=(Buffer &&other) noexcept {
+      if (this != &other) {
+        Release();
+        _node = std::exchange(other._node, nullptr);
+      }
+      return *this;
+    }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    /**
+     * @brief Returns the buffer to its pool.
+     */
+    ~Buffer() noexcept { Release(); }
+
+    /**
+     * @brief Returns the underlying bytes.
+     * @return The underlying bytes.
+     */
+    [[nodiscard]] std::vector<std::byte> &operator*() noexcept { return _node->bytes; }
+
+    /**
+     * @brief Returns the underlying bytes.
+     * @return The underlying bytes.
+     */
+    [[nodiscard]] const std::vector<std::byte> &operator*() const noexcept { return _node->bytes; }
+
+    /**
+     * @brief Accesses the underlying bytes.
+     * @return The underlying bytes.
+     */
+    [[nodiscard]] std::vector<std::byte> *operator->() noexcept { return &_node->bytes; }
+
+    /**
+     * @brief Accesses the underlying bytes.
+     * @return The underlying bytes.
+     */
+    [[nodiscard]] const std::vector<std::byte> *operator->() const noexcept { return &_node->bytes; }
+
+    /**
+     * @brief Returns whether the handle holds a buffer.
+     * @return Whether the handle holds a buffer.
+     */
+    explicit operator bool() const noexcept { return _node != nullptr; }
+
+   private:
+    friend class BufferPool;
+
+    /**
+     * @brief Wraps a buffer borrowed from a pool.
+     * @param node The buffer.
+     */
+    explicit Buffer(Node *node) noexcept : _node(node) {}
+
+    /**
+     * @brief Hands the buffer back to its pool, if any.
+     */
+    void Release() noexcept {
+      if (_node != nullptr) {
+        Node *node = std::exchange(_node, nullptr);
+        node->pool->Recycle(node);
+      }
+    }
+
+    /// @brief The borrowed buffer.
+    Node *_node{nullptr};
+  };
+
+  /**
+   * @brief Creates a new buffer pool.
+   * @param buf_size The usual size of the buffers. Buffers grown beyond
+   * max_growth times this size are freed instead of being recycled.
+   * @param max_free The maximum number of idle buffers to keep around.
+   * @param max_growth How much larger than buf_size a buffer may be and
+   * still be recycled.
+   */
+  [[nodiscard]] explicit BufferPool(std::size_t buf_size, std::size_t max_free = 1024,
+                                    std::size_t max_growth = 16)
+      : _buf_size(buf_size), _max_free(max_free),
+        _max_capacity(buf_size * max_growth) {
+    _free.reserve(max_free);
+  }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  /**
+   * @brief Frees the idle buffers. Every borrowed buffer must have been
+   * returned already.
+   */
+  ~BufferPool() noexcept {
+    for (Node *node : _free) {
+      delete node;
+    }
+  }
+
+  /**
+   * @brief Borrows a buffer of exactly buf_size bytes, e.g. for receiving.
+   * The contents are whatever the previous user left in it. Growing the
+   * buffer back to buf_size zero-fills the bytes past the size it was
+   * returned with, so only buffers returned at buf_size skip the fill.
+   * @return The buffer.
+   */
+  [[nodiscard]] Buffer AcquireSized() {
+    Buffer buf = Acquire();
+    buf->resize(_buf_size);
+    return buf;
+  }
+
+  /**
+   * @brief Borrows an empty buffer with at least buf_size bytes of
+   * capacity, e.g. for sending.
+   * @return The buffer.
+   */
+  [[nodiscard]] Buffer AcquireEmpty() {
+    Buffer buf = Acquire();
+    buf->clear();
+    return buf;
+  }
+
+  /**
+   * @brief Returns the usual size of the buffers.
+   * @return The buffer size.
+   */
+  [[nodiscard]] constexpr std::size_t buf_size() const noexcept { return _buf_size; }
+
+ private:
+  /**
+   * @brief Takes an idle buffer, or allocates a new one if there is none.
+   * @return The buffer.
+   */
+  [[nodiscard]] Buffer Acquire() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_free.empty()) {
+        Buffer buf(_free.back());
+        _free.pop_back();
+        return buf;
+      }
+    }
+    auto node = std::make_unique<Node>(Node{.pool = this, .bytes = {}});
+    node->bytes.reserve(_buf_size);
+    return Buffer(node.release());
+  }
+
+  /**
+   * @brief Keeps a returned buffer for reuse, unless the pool is full or the
+   * buffer grew too large.
+   * @param node The returned buffer.
+   */
+  void Recycle(Node *node) noexcept {
+    if (node->bytes.capacity() <= _max_capacity) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_free.size() < _max_free) {
+        _free.push_back(node);
+        return;
+      }
+    }
+    delete node;
+  }
+
+  /// @brief The usual size of the buffers.
+  std::size_t _buf_size;
+  /// @brief The maximum number of idle buffers.
+  std::size_t _max_free;
+  /// @brief The maximum capacity of a recycled buffer.
+  std::size_t _max_capacity;
+
+  /// @brief Protects the idle buffers.
+  std::mutex _mutex;
+  /// @brief The idle buffers.
+  std::vector<Node *> _free;
+};
+
+}  // namespace tcp
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "address.h"
+
+namespace tcp {
+
+/// @brief Session data of handlers that do not declare any.
+struct NoSession {};
+
+/**
+ * @brief Context of a connection, created when it is accepted and handed to
+ * every handler callback about it.
+ *
+ * Updates of a connection may run concurrently in level-triggered mode, so
+ * handlers keeping state in the session should either guard it, run the
+ * server edge-triggered, which never has two updates of a connection in
+ * flight, or use the affinity task queue, which runs them in order on one
+ * worker.
+ * @tparam Session The handler's per-connection data.
+ */
+template <typename Session = NoSession>
+struct Connection {
+  /**
+   * @brief Creates the context of a new connection.
+   * @param client_fd The client socket.
+   * @param client_addr The client address, as reported by accept.
+   */
+  Connection(const int client_fd, const Address &client_addr) noexcept
+      : fd(client_fd), addr(client_addr) {}
+
+  /// @brief The client socket. Responses must go through the server, never
+  /// straight to the socket.
+  const int fd;
+  /// @brief The client address, of the family of the listener that accepted
+  /// the connection. Clients of Unix domain listeners are usually unnamed.
+  const Address addr;
+  /// @brief The handler's data about this connection.
+  Session session{};
+};
+
+/**
+ * @brief Session type of a handler, Handler::Session if it declares one.
+ * @tparam Handler The handler type.
+ */
+template <typename Handler>
+struct SessionOf {
+  /// @brief The session type.
+  using type = NoSession;
+};
+
+/**
+ * @brief Session type of a handler that declares one.
+ * @tparam Handler The handler type.
+ */
+template <typename Handler>
+  requires requires { typename Handler::Session; }
+struct SessionOf<Handler> {
+  /// @brief The session type.
+  using type = typename Handler::Session;
+};
+
+}  // namespace tcp
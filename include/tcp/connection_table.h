@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "mpmc_queue.h"
+
+namespace tcp {
+
+/**
+ * @brief Table of open connections indexed by socket, owned by a single
+ * reactor.
+ *
+ * Slots are stored contiguously and looked up straight by file descriptor.
+ * Every slot counts the connections it held, and a connection is looked up
+ * by a key made of its descriptor and that generation, the same key its epoll
+ * events carry. An event or a lookup left over from a closed connection thus
+ * misses, instead of landing on a new connection that got the same
+ * descriptor.
+ * @tparam T The handle stored per connection.
+ */
+template <typename T>
+class ConnectionTable {
+ public:
+  /**
+   * @brief Returns the key of a connection.
+   * @param fd The connection's socket.
+   * @param generation The generation of its slot, zero for descriptors that
+   * are not connections.
+   * @return The key.
+   */
+  [[nodiscard]] static constexpr std::uint64_t Key(const int fd, const std::uint32_t generation) noexcept {
+    return (std::uint64_t{generation} << 32) | static_cast<std::uint32_t>(fd);
+  }
+
+  /**
+   * @brief Stores a new connection, replacing whatever the slot held.
+   * @param fd The connection's socket.
+   * @param value The handle of the connection.
+   * @return The key of the connection.
+   */
+  std::uint64_t Insert(const int fd, T value) {
+    const auto index = static_cast<std::size_t>(fd);
+    if (index >= _slots.size()) {
+      _slots.resize(std::max(index + 1, _slots.size() * 2));
+    }
+
+    // Generation zero is never used, so keys of other descriptors never match
+    Slot &slot = _slots[index];
+    if (++slot.generation == 0) {
+      slot.generation = 1;
+    }
+    if (!slot.value) {
+      ++_size;
+    }
+    slot.value = std::move(value);
+    return Key(fd, slot.generation);
+  }
+
+  /**
+   * @brief Finds a connection.
+   * @param key The key of the connection.
+   * @return The handle of the connection, or null if it is gone.
+   */
+  [[nodiscard]] T *Find(const std::uint64_t key) noexcept {
+    Slot *slot = SlotOf(key);
+    return slot == nullptr ? nullptr : &slot->value;
+  }
+
+  /**
+   * @brief Forgets a connection, unless its slot was reused already.
+   * @param key The key of the connection.
+   */
+  void Erase(const std::uint64_t key) noexcept {
+    if (Slot *slot = SlotOf(key); slot != nullptr) {
+      slot->value = T();
+      --_size;
+    }
+  }
+
+  /**
+   * @brief Calls a function on every connection. The function must not
+   * insert nor erase connections.
+   * @param f The function, given the handle of each connection.
+   */
+  template <typename F>
+  void ForEach(F &&f) {
+    for (Slot &slot : _slots) {
+      if (slot.value) {
+        f(slot.value);
+      }
+    }
+  }
+
+  /**
+   * @brief Returns the number of connections.
+   * @return The number of connections.
+   */
+  [[nodiscard]] std::size_t Size() const noexcept { return _size; }
+
+ private:
+  /// @brief A connection slot, a few of them per cache line and never
+  /// straddling two.
+  struct alignas(kCacheLineSize / 2) Slot {
+    /// @brief The handle of the connection, empty if there is none.
+    T value{};
+    /// @brief The number of connections the slot held.
+    std::uint32_t generation{0};
+  };
+
+  /**
+   * @brief Returns the slot holding a connection.
+   * @param key The key of the connection.
+   * @return The slot, or null if the connection is gone.
+   */
+  [[nodiscard]] Slot *SlotOf(const std::uint64_t key) noexcept {
+    const auto index = static_cast<std::size_t>(static_cast<std::uint32_t>(key));
+    if (index >= _slots.size()) {
+      return nullptr;
+    }
+    Slot &slot = _slots[index];
+    return slot.generation == static_cast<std::uint32_t>(key >> 32) && slot.value ? &slot : nullptr;
+  }
+
+  /// @brief The slots, by socket.
+  std::vector<Slot> _slots;
+  /// @brief The number of connections.
+  std::size_t _size{0};
+};
+
+}  // namespace tcp
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+namespace tcp {
+
+/**
+ * @brief Lazily started coroutine producing a T, e.g. the keep alive flag of
+ * an asynchronous OnRead.
+ *
+ * Awaiting an Async from another coroutine starts it and resumes the awaiter
+ * once it is done, without going through any scheduler. A handler throwing
+ * out of a coroutine terminates the process, like out of a noexcept
+ * callback.
+ * @tparam T The result type.
+ */
+template <typename T = void>
+class [[nodiscard]] Async {
+  /// @brief Storage for a value result.
+  struct ValueResult {
+    /// @brief The result, once returned.
+    std::optional<T> value;
+
+    /**
+     * @brief Stores the result.
+     * @param result The result.
+     */
+    void return_value(T result) { value.emplace(std::move(result)); }
+
+    /**
+     * @brief Takes the result.
+     * @return The result.
+     */
+    T Take() { return std::move(*value); }
+  };
+
+  /// @brief Storage for no result.
+  struct VoidResult {
+    /**
+     * @brief Marks the end of the coroutine.
+     */
+    void return_void() noexcept {}
+
+    /**
+     * @brief Takes nothing.
+     */
+    void Take() noexcept {}
+  };
+
+ public:
+  /// @brief Promise of the coroutine.
+  struct promise_type : std::conditional_t<std::is_void_v<T>, VoidResult, ValueResult> {
+    /// @brief The coroutine awaiting this one, if any.
+    std::coroutine_handle<> continuation;
+
+    /**
+     * @brief Creates the Async the caller gets.
+     * @return The Async.
+     */
+    Async get_return_object() noexcept { return Async(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+    /**
+     * @brief Leaves the coroutine suspended until started.
+     * @return The initial awaiter.
+     */
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    /**
+     * @brief Hands control back to the awaiting coroutine, if any, once done.
+     * @return The final awaiter.
+     */
+    auto final_suspend() noexcept {
+      struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+          const std::coroutine_handle<> continuation = handle.promise().continuation;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+      };
+      return FinalAwaiter{};
+    }
+
+    /**
+     * @brief Terminates the process, handlers must not throw.
+     */
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  /**
+   * @brief Takes over the coroutine of another Async.
+   * @param other The Async to take the coroutine from.
+   */
+  Async(Async &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+
+  /**
+   * @brief Destroys the current coroutine and takes over the one of another
+   * Async.
+   * @param other The Async to take the coroutine from.
+   * @return This Async.
+   */
+  Async &operator=(Async &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      _handle = std::exchange(other._handle, nullptr);
+    }
+    return *this;
+  }
+
+  Async(const Async &) = delete;
+  Async &operator=(const Async &) = delete;
+
+  /**
+   * @brief Creates an Async without a coroutine.
+   */
+  Async() noexcept = default;
+
+  /**
+   * @brief Destroys the coroutine, wherever it is suspended.
+   */
+  ~Async() noexcept { Reset(); }
+
+  /**
+   * @brief Starts the coroutine when awaited.
+   * @return False, the coroutine always runs.
+   */
+  bool await_ready() const noexcept { return false; }
+
+  /**
+   * @brief Starts the coroutine, resuming the awaiter once it is done.
+   * @param awaiter The awaiting coroutine.
+   * @return The coroutine to run.
+   */
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+    _handle.promise().continuation = awaiter;
+    return _handle;
+  }
+
+  /**
+   * @brief Returns the result of the coroutine.
+   * @return The result.
+   */
+  T await_resume() { return _handle.promise().Take(); }
+
+  /**
+   * @brief Returns the coroutine, for starting it from outside a coroutine.
+   * @return The coroutine.
+   */
+  [[nodiscard]] std::coroutine_handle<> handle() const noexcept { return _handle; }
+
+  /**
+   * @brief Returns whether the coroutine returned.
+   * @return Whether the coroutine is done.
+   */
+  [[nodiscard]] bool done() const noexcept { return _handle.done(); }
+
+  /**
+   * @brief Returns the result of a coroutine that is done.
+   * @return The result.
+   */
+  T Result() { return _handle.promise().Take(); }
+
+  /**
+   * @brief Returns whether there is a coroutine.
+   * @return Whether there is a coroutine.
+   */
+  explicit operator bool() const noexcept { return static_cast<bool>(_handle); }
+
+ private:
+  /**
+   * @brief Wraps a coroutine.
+   * @param handle The coroutine.
+   */
+  explicit Async(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) {}
+
+  /**
+   * @brief Destroys the coroutine, if any.
+   */
+  void Reset() noexcept {
+    if (_handle) {
+      std::exchange(_handle, nullptr).destroy();
+    }
+  }
+
+  /// @brief The coroutine.
+  std::coroutine_handle<promise_type> _handle;
+};
+
+/**
+ * @brief The I/O a coroutine handler may wait on, driven by the reactor
+ * serving its connection. Created by the server for every connection.
+ *
+ * Waiting never ties up a thread: the coroutine is resumed by whichever
+ * thread runs the connection's next update.
+ */
+class Io {
+ public:
+  /// @brief Type-erased operations of the server on the connection.
+  struct Ops {
+    /// @brief Waits for the next frame, returns false if one is ready or the
+    /// connection is closed.
+    bool (*read)(void *server, void *conn, std::coroutine_handle<> handle);
+    /// @brief Takes the next frame, empty once the connection is closed.
+    std::span<const std::byte> (*read_result)(void *server, void *conn);
+    /// @brief Hands the output over and waits for room, returns false if
+    /// there is room already or the connection is closed.
+    bool (*write)(void *server, void *conn, std::coroutine_handle<> handle);
+    /// @brief Returns whether the connection is still open.
+    bool (*is_open)(void *server, void *conn);
+    /// @brief Waits for a timer, returns false if the connection is closed.
+    bool (*sleep)(void *server, void *conn, std::chrono::nanoseconds delay, std::coroutine_handle<> handle);
+  };
+
+  /// @brief Awaiter of the next frame.
+  struct ReadAwaiter {
+    /// @brief The I/O of the connection.
+    Io &io;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) { return io._ops->read(io._server, io._conn, handle); }
+    std::span<const std::byte> await_resume() { return io._ops->read_result(io._server, io._conn); }
+  };
+
+  /// @brief Awaiter of room in the write queue.
+  struct WriteAwaiter {
+    /// @brief The I/O of the connection.
+    Io &io;
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> handle) { return io._ops->write(io._server, io._conn, handle); }
+    bool await_resume() { return io._ops->is_open(io._server, io._conn); }
+  };
+
+  /// @brief Awaiter of a timer.
+  struct SleepAwaiter {
+    /// @brief The I/O of the connection.
+    Io &io;
+    /// @brief How long to wait.
+    std::chrono::nanoseconds delay;
+    bool await_ready() const noexcept { return delay <= std::chrono::nanoseconds::zero(); }
+    bool await_suspend(std::coroutine_handle<> handle) { return io._ops->sleep(io._server, io._conn, delay, handle); }
+    bool await_resume() { return io._ops->is_open(io._server, io._conn); }
+  };
+
+  /**
+   * @brief Binds the operations of a server to one of its connections.
+   * @param server The server.
+   * @param conn The connection.
+   * @param ops The operations.
+   */
+  Io(void *server, void *conn, const Ops &ops) noexcept : _server(server), _conn(conn), _ops(&ops) {}
+
+  /**
+   * @brief Waits for the next frame from the client.
+   * @return An awaiter yielding the frame, valid until the next Read or the
+   * end of the handler, or an empty span once the connection is closed.
+   */
+  [[nodiscard]] ReadAwaiter Read() noexcept { return {*this}; }
+
+  /**
+   * @brief Hands the output built so far to the connection, and waits until
+   * the client drains the pending responses if they went past the high
+   * watermark.
+   * @return An awaiter yielding whether the connection is still open.
+   */
+  [[nodiscard]] WriteAwaiter Write() noexcept { return {*this}; }
+
+  /**
+   * @brief Waits on a timer of the reactor serving the connection. Closing
+   * the connection ends the wait early.
+   * @param delay How long to wait.
+   * @return An awaiter yielding whether the connection is still open.
+   */
+  [[nodiscard]] SleepAwaiter Sleep(std::chrono::nanoseconds delay) noexcept { return {*this, delay}; }
+
+ private:
+  /// @brief The server.
+  void *_server;
+  /// @brief The connection.
+  void *_conn;
+  /// @brief The operations of the server.
+  const Ops *_ops;
+};
+
+}  // namespace tcp
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <span>
+
+namespace tcp {
+
+/**
+ * Framing policies split the byte stream of a connection into the messages
+ * handed to OnRead. A policy provides:
+ *
+ * - `static std::size_t FrameSize(std::span<const std::byte> data)`, the size
+ *   of the frame data starts with, kIncompleteFrame if more bytes are needed
+ *   to tell, or kInvalidFrame if the stream is malformed.
+ * - `static std::span<const std::byte> Payload(std::span<const std::byte> frame)`,
+ *   the part of a complete frame handed to the handler.
+ */
+
+/// @brief Frame size telling that the frame is not complete yet.
+inline constexpr std::size_t kIncompleteFrame = 0;
+
+/// @brief Frame size telling that the stream is malformed, which closes the
+/// connection.
+inline constexpr std::size_t kInvalidFrame = std::numeric_limits<std::size_t>::max();
+
+/**
+ * @brief No framing, every read is handed to the handler as it came.
+ */
+struct RawFraming {
+  /**
+   * @brief Returns the size of the first frame.
+   * @param data The bytes received.
+   * @return The size of all of them.
+   */
+  [[nodiscard]] static constexpr std::size_t FrameSize(std::span<const std::byte> data) noexcept {
+    return data.size();
+  }
+
+  /**
+   * @brief Returns the payload of a frame.
+   * @param frame The frame.
+   * @return The whole frame.
+   */
+  [[nodiscard]] static constexpr std::span<const std::byte> Payload(std::span<const std::byte> frame) noexcept {
+    return frame;
+  }
+};
+
+/**
+ * @brief Frames made of a big endian length header followed by that many
+ * bytes of payload.
+ * @tparam HeaderSize The size of the length header, from 1 to 8 bytes.
+ * @tparam MaxPayload The largest payload accepted.
+ */
+template <std::size_t HeaderSize = 4, std::size_t MaxPayload = 16 * 1024 * 1024>
+struct LengthPrefixFraming {
+  static_assert(HeaderSize >= 1 && HeaderSize <= sizeof(std::size_t), "Invalid length header size");
+
+  /**
+   * @brief Returns the size of the first frame.
+   * @param data The bytes received.
+   * @return The size of the frame, header included.
+   */
+  [[nodiscard]] static constexpr std::size_t FrameSize(std::span<const std::byte> data) noexcept {
+    if (data.size() < HeaderSize) {
+      return kIncompleteFrame;
+    }
+
+    // Decode the header
+    std::size_t payload = 0;
+    for (std::size_t i = 0; i < HeaderSize; ++i) {
+      payload = (payload << 8U) | static_cast<std::size_t>(data[i]);
+    }
+
+    if (payload > MaxPayload) {
+      return kInvalidFrame;
+    }
+    return data.size() < HeaderSize + payload ? kIncompleteFrame : HeaderSize + payload;
+  }
+
+  /**
+   * @brief Returns the payload of a frame.
+   * @param frame The frame.
+   * @return The frame without its header.
+   */
+  [[nodiscard]] static constexpr std::span<const std::byte> Payload(std::span<const std::byte> frame) noexcept {
+    return frame.subspan(HeaderSize);
+  }
+};
+
+/**
+ * @brief Frames ended by a delimiter, e.g. lines.
+ * @tparam Delimiter The byte ending every frame.
+ * @tparam MaxPayload The largest payload accepted.
+ */
+template <char Delimiter = '\n', std::size_t MaxPayload = 64 * 1024>
+struct DelimiterFraming {
+  /**
+   * @brief Returns the size of the first frame.
+   * @param data The bytes received.
+   * @return The size of the frame, delimiter included.
+   */
+  [[nodiscard]] static std::size_t FrameSize(std::span<const std::byte> data) noexcept {
+    // Look for the delimiter no further than the largest frame
+    const std::size_t limit = data.size() < MaxPayload + 1 ? data.size() : MaxPayload + 1;
+    const void *end = std::memchr(data.data(), Delimiter, limit);
+    if (end == nullptr) {
+      return limit > MaxPayload ? kInvalidFrame : kIncompleteFrame;
+    }
+    return static_cast<std::size_t>(static_cast<const std::byte *>(end) - data.data()) + 1;
+  }
+
+  /**
+   * @brief Returns the payload of a frame.
+   * @param frame The frame.
+   * @return The frame without its delimiter.
+   */
+  [[nodiscard]] static constexpr std::span<const std::byte> Payload(std::span<const std::byte> frame) noexcept {
+    return frame.first(frame.size() - 1);
+  }
+};
+
+/**
+ * @brief Frames that all have the same size.
+ * @tparam Size The size of every frame.
+ */
+template <std::size_t Size>
+struct FixedSizeFraming {
+  static_assert(Size > 0, "Frames must not be empty");
+
+  /**
+   * @brief Returns the size of the first frame.
+   * @param data The bytes received.
+   * @return The size of the frame.
+   */
+  [[nodiscard]] static constexpr std::size_t FrameSize(std::span<const std::byte> data) noexcept {
+    return data.size() < Size ? kIncompleteFrame : Size;
+  }
+
+  /**
+   * @brief Returns the payload of a frame.
+   * @param frame The frame.
+   * @return The whole frame.
+   */
+  [[nodiscard]] static constexpr std::span<const std::byte> Payload(std::span<const std::byte> frame) noexcept {
+    return frame;
+  }
+};
+
+/**
+ * @brief Policy splitting the byte stream of a connection into frames.
+ * @tparam F The policy type.
+ */
+template <typename F>
+concept FramingPolicy = requires(std::span<const std::byte> data) {
+  { F::FrameSize(data) } -> std::same_as<std::size_t>;
+  { F::Payload(data) } -> std::same_as<std::span<const std::byte>>;
+};
+
+}  // namespace tcp
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "connection.h"
+#include "coro.h"
+#include "output.h"
+#include "utils.h"
+
+namespace tcp {
+
+/**
+ * @brief Handler reading exactly the bytes received, and building its
+ * responses in a server-owned output.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept SpanReadHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn,
+                                   std::span<const std::byte> in, Output &out) {
+  { handler.OnRead(conn, in, out) } -> std::convertible_to<bool>;
+};
+
+/**
+ * @brief Handler reading a whole receive buffer, terminated by a null byte
+ * after the bytes received, and filling a response vector.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept VectorReadHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn,
+                                     const std::vector<std::byte> &in, std::vector<std::byte> &out) {
+  { handler.OnRead(conn, in, out) } -> std::convertible_to<bool>;
+};
+
+/**
+ * @brief Handler reading frames in a coroutine, which may wait on the
+ * connection's I/O and timers without tying up a thread. A connection runs
+ * one coroutine at a time, frames received in the meantime wait for it.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept AsyncReadHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn,
+                                    std::span<const std::byte> in, Output &out, Io &io) {
+  { handler.OnRead(conn, in, out, io) } -> std::same_as<Async<bool>>;
+};
+
+/**
+ * @brief Handler welcoming new connections through a server-owned output.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept SpanNewHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn, Output &out) {
+  { handler.OnNew(conn, out) } -> std::convertible_to<bool>;
+};
+
+/**
+ * @brief Handler welcoming new connections by filling a response vector.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept VectorNewHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn,
+                                    std::vector<std::byte> &out) {
+  { handler.OnNew(conn, out) } -> std::convertible_to<bool>;
+};
+
+/**
+ * @brief Handler welcoming new connections without ever writing to them, so
+ * no output is set up for the welcome.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept SilentNewHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn) {
+  { handler.OnNew(conn) } -> std::convertible_to<bool>;
+};
+
+/**
+ * @brief Handler told about new connections. Without OnNew they are kept
+ * open without involving the handler at all.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept NewHandler = SpanNewHandler<H> || VectorNewHandler<H> || SilentNewHandler<H>;
+
+/**
+ * @brief Handler told about closed connections. Without OnClose closing a
+ * connection dispatches nothing.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept CloseHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn) {
+  handler.OnClose(conn);
+};
+
+/**
+ * @brief Handler told about connections closed by an error. Without OnError
+ * they are closed silently, and only counted in the metrics.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept ErrorHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn, const Error &error) {
+  handler.OnError(conn, error);
+};
+
+/**
+ * @brief Handler replying to the updates rejected under Overload::Shed, e.g.
+ * with a canned busy reply. The callback runs on the reactor, so it must be
+ * cheap. Without it rejected connections are closed without a word.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept RejectHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn, Output &out) {
+  handler.OnReject(conn, out);
+};
+
+/// @brief Which timeout closed a connection.
+enum class Timeout {
+  /// @brief Nothing was received or written for Options::idle_timeout.
+  Idle,
+  /// @brief A frame took longer than Options::read_timeout to arrive.
+  Read,
+  /// @brief The client took none of its pending responses for
+  /// Options::write_timeout.
+  Write,
+};
+
+/**
+ * @brief Handler told about connections closed by a timeout. Other handlers
+ * get an OnClose for them instead.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept TimeoutHandler = requires(H &handler, Connection<typename SessionOf<H>::type> &conn, Timeout kind) {
+  handler.OnTimeout(conn, kind);
+};
+
+/**
+ * @brief Handler cheap enough for its callbacks to run on the reactor thread
+ * that received the event, skipping the thread pool. Such a handler declares
+ * `static constexpr bool inline_dispatch = true`. A slow callback stalls every
+ * connection of its reactor.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept InlineHandler = requires {
+  requires H::inline_dispatch;
+};
+
+/**
+ * @brief Handler the server can run, with either flavour of callbacks. Only
+ * OnRead is required, the server compiles out the paths of the callbacks a
+ * handler leaves out, so it only pays for the ones it uses.
+ * @tparam H The handler type.
+ */
+template <typename H>
+concept ConnectionHandler = SpanReadHandler<H> || VectorReadHandler<H> || AsyncReadHandler<H>;
+
+}  // namespace tcp
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+
+namespace tcp {
+
+/// @brief Most listening sockets handed over at once.
+inline constexpr std::size_t kMaxHandoffSockets = 64;
+
+/**
+ * @brief Returns the address of a Unix socket.
+ * @param path The path of the socket.
+ * @return The address.
+ */
+[[nodiscard]] inline sockaddr_un HandoffAddress(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    throw Error("Invalid hand-off socket path.", Error::Kind::Handoff);
+  }
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
+}
+
+/**
+ * @brief Opens the non-blocking Unix socket a newer process restarting a
+ * server connects to, replacing whatever socket file is at the path.
+ * @param path The path of the socket.
+ * @return The listening socket.
+ */
+[[nodiscard]] inline int OpenHandoffSocket(const std::string &path) {
+  const sockaddr_un addr = HandoffAddress(path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw Error("Failed to create hand-off socket.", Error::Kind::Handoff);
+  }
+
+  // The file of the process being restarted is taken over, that process
+  // keeps its socket until it stops
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1 || listen(fd, 1) == -1) {
+    close(fd);
+    throw Error("Failed to bind hand-off socket.", Error::Kind::Handoff);
+  }
+  return fd;
+}
+
+/**
+ * @brief Connects to the hand-off socket of a running server.
+ * @param path The path of the socket.
+ * @return The connected socket, or -1 if no server listens on the path.
+ */
+[[nodiscard]] inline int ConnectHandoff(const std::string &path) {
+  const sockaddr_un addr = HandoffAddress(path);
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw Error("Failed to create hand-off socket.", Error::Kind::Handoff);
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1) {
+    close(fd);
+    if (errno == ENOENT || errno == ECONNREFUSED) {
+      return -1;
+    }
+    throw Error("Failed to connect to hand-off socket.", Error::Kind::Handoff);
+  }
+  return fd;
+}
+
+/**
+ * @brief Sends listening sockets over a Unix socket as SCM_RIGHTS ancillary
+ * data, along with a single byte since ancillary data needs a payload.
+ * @param fd The Unix socket.
+ * @param sockets The sockets to send. The sender keeps its own copies.
+ * @return Whether they were sent.
+ */
+[[nodiscard]] inline bool SendSockets(const int fd, const std::span<const int> sockets) noexcept {
+  if (sockets.empty() || sockets.size() > kMaxHandoffSockets) {
+    return false;
+  }
+
+  // Room for the largest message, aligned for a cmsghdr
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxHandoffSockets)]{};
+  char byte = 'L';
+  iovec iov = {.iov_base = &byte, .iov_len = 1};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * sockets.size());
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * sockets.size());
+  std::memcpy(CMSG_DATA(cmsg), sockets.data(), sizeof(int) * sockets.size());
+
+  ssize_t n = -1;
+  do {
+    n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (n == -1 && errno == EINTR);
+  return n == 1;
+}
+
+/**
+ * @brief Receives the listening sockets a running server sends over a Unix
+ * socket, waiting for them.
+ * @param fd The Unix socket.
+ * @return The sockets, closed on exec, in the order they were sent.
+ */
+[[nodiscard]] inline std::vector<int> ReceiveSockets(const int fd) {
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxHandoffSockets)]{};
+  char byte = 0;
+  iovec iov = {.iov_base = &byte, .iov_len = 1};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n = -1;
+  do {
+    n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (n == -1 && errno == EINTR);
+
+  // Collect the sockets, even from a truncated message so none of them leaks
+  std::vector<int> sockets;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      const std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const std::size_t first = sockets.size();
+      sockets.resize(first + count);
+      std::memcpy(sockets.data() + first, CMSG_DATA(cmsg), sizeof(int) * count);
+    }
+  }
+
+  // Check if the whole message arrived
+  if (n != 1 || (msg.msg_flags & MSG_CTRUNC) != 0 || sockets.empty()) {
+    for (const int socket_fd : sockets) {
+      close(socket_fd);
+    }
+    throw Error("Failed to receive the listening sockets.", Error::Kind::Handoff);
+  }
+  return sockets;
+}
+
+}  // namespace tcp
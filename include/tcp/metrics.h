@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#include "mpmc_queue.h"
+
+namespace tcp {
+
+/**
+ * @brief Counter written by a single thread and read by any.
+ *
+ * The writer adds with a plain load and store instead of a locked
+ * read-modify-write, readers may see a slightly stale value.
+ */
+class Counter {
+ public:
+  /**
+   * @brief Adds to the counter. Only called by the owning thread.
+   * @param n The amount to add.
+   */
+  void Add(const std::uint64_t n = 1) noexcept {
+    _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Returns the value of the counter.
+   * @return The value.
+   */
+  [[nodiscard]] std::uint64_t Load() const noexcept { return _value.load(std::memory_order_relaxed); }
+
+ private:
+  /// @brief The value.
+  std::atomic<std::uint64_t> _value{0};
+};
+
+/**
+ * @brief Aggregated copy of one or more histograms.
+ *
+ * Values are bucketed like in an HDR histogram: exactly below 16, then in 16
+ * linear buckets per power of two, so every bucket is within about 6% of
+ * the values it holds. Percentiles report the upper bound of their bucket.
+ */
+class HistogramSnapshot {
+ public:
+  /// @brief Linear buckets per power of two.
+  static constexpr std::size_t kSubBuckets = 16;
+  /// @brief Number of buckets, enough for any 64 bit value.
+  static constexpr std::size_t kBuckets = (64 - std::bit_width(kSubBuckets - 1) + 1) * kSubBuckets;
+
+  /**
+   * @brief Returns the bucket a value falls into.
+   * @param value The value.
+   * @return The index of the bucket.
+   */
+  [[nodiscard]] static constexpr std::size_t BucketOf(const std::uint64_t value) noexcept {
+    if (value < kSubBuckets) {
+      return static_cast<std::size_t>(value);
+    }
+    const auto shift = static_cast<std::size_t>(std::bit_width(value) - std::bit_width(kSubBuckets));
+    return (shift + 1) * kSubBuckets + static_cast<std::size_t>(value >> shift) - kSubBuckets;
+  }
+
+  /**
+   * @brief Returns the largest value a bucket holds.
+   * @param bucket The index of the bucket.
+   * @return The upper bound of the bucket, inclusive.
+   */
+  [[nodiscard]] static constexpr std::uint64_t UpperBoundOf(const std::size_t bucket) noexcept {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    const std::size_t shift = bucket / kSubBuckets - 1;
+    const std::uint64_t sub = bucket % kSubBuckets + kSubBuckets;
+    return ((sub + 1) << shift) - 1;
+  }
+
+  /**
+   * @brief Returns the number of values recorded.
+   * @return The count.
+   */
+  [[nodiscard]] std::uint64_t Count() const noexcept { return _count; }
+
+  /**
+   * @brief Returns the mean of the values recorded.
+   * @return The mean, zero if there is none.
+   */
+  [[nodiscard]] double Mean() const noexcept {
+    return _count == 0 ? 0.0 : static_cast<double>(_sum) / static_cast<double>(_count);
+  }
+
+  /**
+   * @brief Returns the largest value recorded.
+   * @return The maximum, zero if there is none.
+   */
+  [[nodiscard]] std::uint64_t Max() const noexcept { return _max; }
+
+  /**
+   * @brief Returns a value at least as large as a fraction of the values
+   * recorded.
+   * @param percentile The percentile, between 0 and 100.
+   * @return The upper bound of the bucket holding the percentile, never more
+   * than the maximum, zero if nothing was recorded.
+   */
+  [[nodiscard]] std::uint64_t Percentile(const double percentile) const noexcept {
+    if (_count == 0) {
+      return 0;
+    }
+    const double clamped = std::clamp(percentile, 0.0, 100.0);
+    const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(clamped / 100.0 * static_cast<double>(_count) + 0.5));
+    std::uint64_t seen = 0;
+    for (std::size_t bucket = 0; bucket < kBuckets; ++bucket) {
+      seen += _counts[bucket];
+      if (seen >= rank) {
+        return std::min(UpperBoundOf(bucket), _max);
+      }
+    }
+    return _max;
+  }
+
+  /**
+   * @brief Returns the number of values in a bucket.
+   * @param bucket The index of the bucket.
+   * @return The count of the bucket.
+   */
+  [[nodiscard]] std::uint64_t CountOf(const std::size_t bucket) const noexcept { return _counts[bucket]; }
+
+ private:
+  friend class Histogram;
+
+  /// @brief The number of values per bucket.
+  std::array<std::uint64_t, kBuckets> _counts{};
+  /// @brief The number of values.
+  std::uint64_t _count{0};
+  /// @brief The sum of the values.
+  std::uint64_t _sum{0};
+  /// @brief The largest value.
+  std::uint64_t _max{0};
+};
+
+/**
+ * @brief Histogram of values written by a single thread and read by any,
+ * bucketed like HistogramSnapshot. Recording never locks nor allocates.
+ */
+class Histogram {
+ public:
+  /**
+   * @brief Records a value. Only called by the owning thread.
+   * @param value The value.
+   */
+  void Record(const std::uint64_t value) noexcept {
+    Bump(_counts[HistogramSnapshot::BucketOf(value)], 1);
+    Bump(_sum, value);
+    if (value > _max.load(std::memory_order_relaxed)) {
+      _max.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Adds the values recorded so far to a snapshot.
+   * @param snapshot The snapshot.
+   */
+  void MergeInto(HistogramSnapshot &snapshot) const noexcept {
+    for (std::size_t bucket = 0; bucket < HistogramSnapshot::kBuckets; ++bucket) {
+      const std::uint64_t count = _counts[bucket].load(std::memory_order_relaxed);
+      snapshot._counts[bucket] += count;
+      snapshot._count += count;
+    }
+    snapshot._sum += _sum.load(std::memory_order_relaxed);
+    snapshot._max = std::max(snapshot._max, _max.load(std::memory_order_relaxed));
+  }
+
+ private:
+  /**
+   * @brief Adds to an atomic only written by the calling thread.
+   * @param value The atomic.
+   * @param n The amount to add.
+   */
+  static void Bump(std::atomic<std::uint64_t> &value, const std::uint64_t n) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  /// @brief The number of values per bucket.
+  std::array<std::atomic<std::uint64_t>, HistogramSnapshot::kBuckets> _counts{};
+  /// @brief The sum of the values.
+  std::atomic<std::uint64_t> _sum{0};
+  /// @brief The largest value.
+  std::atomic<std::uint64_t> _max{0};
+};
+
+/// @brief Counters and latency histograms of the server, all latencies in
+/// nanoseconds.
+struct MetricsSnapshot {
+  /// @brief Connections accepted.
+  std::uint64_t accepts{0};
+  /// @brief Connections closed.
+  std::uint64_t closes{0};
+  /// @brief Connections closed by a timeout.
+  std::uint64_t timeouts{0};
+  /// @brief Errors reported to the handler.
+  std::uint64_t errors{0};
+  /// @brief Updates and connections rejected by the overload policy.
+  std::uint64_t rejects{0};
+  /// @brief Times a connection stopped being read from by the overload
+  /// policy.
+  std::uint64_t throttles{0};
+  /// @brief Reads that received bytes.
+  std::uint64_t reads{0};
+  /// @brief Bytes received.
+  std::uint64_t bytes_read{0};
+  /// @brief Bytes written.
+  std::uint64_t bytes_written{0};
+  /// @brief Tasks waiting in the thread pool when the snapshot was taken.
+  std::uint64_t queued{0};
+
+  /// @brief From the reactor waking up with an event to handing its update
+  /// over, to the pool or to the handler.
+  HistogramSnapshot dispatch_latency;
+  /// @brief Time the updates of connections spent in the thread pool's
+  /// queue.
+  HistogramSnapshot queue_wait;
+  /// @brief Time spent in the handler's callbacks.
+  HistogramSnapshot handler_time;
+  /// @brief From a response being queued behind nothing to the socket taking
+  /// the last of the responses queued in the meantime.
+  HistogramSnapshot write_time;
+};
+
+/**
+ * @brief Counters and histograms of a single thread, on their own cache
+ * lines so threads never share them.
+ */
+struct alignas(kCacheLineSize) ThreadMetrics {
+  /// @brief Connections accepted.
+  Counter accepts;
+  /// @brief Connections closed.
+  Counter closes;
+  /// @brief Connections closed by a timeout.
+  Counter timeouts;
+  /// @brief Errors reported to the handler.
+  Counter errors;
+  /// @brief Updates and connections rejected by the overload policy.
+  Counter rejects;
+  /// @brief Times a connection stopped being read from by the overload
+  /// policy.
+  Counter throttles;
+  /// @brief Reads that received bytes.
+  Counter reads;
+  /// @brief Bytes received.
+  Counter bytes_read;
+  /// @brief Bytes written.
+  Counter bytes_written;
+
+  /// @brief See MetricsSnapshot::dispatch_latency.
+  Histogram dispatch_latency;
+  /// @brief See MetricsSnapshot::queue_wait.
+  Histogram queue_wait;
+  /// @brief See MetricsSnapshot::handler_time.
+  Histogram handler_time;
+  /// @brief See MetricsSnapshot::write_time.
+  Histogram write_time;
+
+  /**
+   * @brief Adds the thread's metrics to a snapshot.
+   * @param snapshot The snapshot.
+   */
+  void MergeInto(MetricsSnapshot &snapshot) const noexcept {
+    snapshot.accepts += accepts.Load();
+    snapshot.closes += closes.Load();
+    snapshot.timeouts += timeouts.Load();
+    snapshot.errors += errors.Load();
+    snapshot.rejects += rejects.Load();
+    snapshot.throttles += throttles.Load();
+    snapshot.reads += reads.Load();
+    snapshot.bytes_read += bytes_read.Load();
+    snapshot.bytes_written += bytes_written.Load();
+    dispatch_latency.MergeInto(snapshot.dispatch_latency);
+    queue_wait.MergeInto(snapshot.queue_wait);
+    handler_time.MergeInto(snapshot.handler_time);
+    write_time.MergeInto(snapshot.write_time);
+  }
+};
+
+}  // namespace tcp
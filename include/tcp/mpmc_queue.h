@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace tcp {
+
+/// @brief Size of a cache line, used to keep independently written fields
+/// apart.
+inline constexpr std::size_t kCacheLineSize = 64;
+
+/**
+ * @brief Tells the CPU that the calling thread is busy waiting.
+ */
+inline void CpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue.
+ *
+ * Every cell carries a sequence number telling producers and consumers
+ * whether it is free or full for the current lap, so both sides only contend
+ * on their own position counter (Vyukov's bounded MPMC queue).
+ * @tparam T The element type.
+ */
+template <typename T>
+class MpmcQueue {
+ public:
+  /**
+   * @brief Creates a new queue.
+   * @param capacity The minimum capacity, rounded up to a power of two.
+   */
+  [[nodiscard]] explicit MpmcQueue(std::size_t capacity)
+      : _mask(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+        _cells(std::make_unique<Cell[]>(_mask + 1)) {
+    for (std::size_t i = 0; i <= _mask; ++i) {
+      _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpmcQueue(const MpmcQueue &) = delete;
+  MpmcQueue &operator=(const MpmcQueue &) = delete;
+
+  /**
+   * @brief Destroys the elements still in the queue.
+   */
+  ~MpmcQueue() noexcept {
+    T value;
+    while (TryPop(value)) {
+    }
+  }
+
+  /**
+   * @brief Appends an element if there is room for it.
+   * @param value The element, left untouched if the queue is full.
+   * @return Whether the element was appended.
+   */
+  [[nodiscard]] bool TryPush(T &&value) noexcept {
+    Cell *cell = nullptr;
+    std::size_t pos = _tail.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &_cells[pos & _mask];
+      const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // Full
+      } else {
+        pos = _tail.load(std::memory_order_relaxed);
+      }
+    }
+    ::new (cell->storage) T(std::move(value));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Removes the oldest element if there is one.
+   * @param value Where to move the element to.
+   * @return Whether an element was removed.
+   */
+  [[nodiscard]] bool TryPop(T &value) noexcept {
+    Cell *cell = nullptr;
+    std::size_t pos = _head.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &_cells[pos & _mask];
+      const std::size_t seq = cell->seq.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+      if (diff == 0) {
+        if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;  // Empty
+      } else {
+        pos = _head.load(std::memory_order_relaxed);
+      }
+    }
+    T *stored = std::launder(reinterpret_cast<T *>(cell->storage));
+    value = std::move(*stored);
+    stored->~T();
+    cell->seq.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Returns an estimate of the number of elements in the queue.
+   * @return The approximate size.
+   */
+  [[nodiscard]] std::size_t ApproxSize() const noexcept {
+    const std::size_t tail = _tail.load(std::memory_order_relaxed);
+    const std::size_t head = _head.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  /**
+   * @brief Returns the capacity of the queue.
+   * @return The capacity.
+   */
+  [[nodiscard]] std::size_t capacity() const noexcept { return _mask + 1; }
+
+ private:
+  /// @brief A slot of the ring.
+  struct alignas(kCacheLineSize) Cell {
+    /// @brief Lap the cell is in, and whether it is full for that lap.
+    std::atomic<std::size_t> seq;
+    /// @brief Storage for the element.
+    alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  /// @brief Mask turning a position into a cell index.
+  std::size_t _mask;
+  /// @brief The cells.
+  std::unique_ptr<Cell[]> _cells;
+  /// @brief Next position to push to.
+  alignas(kCacheLineSize) std::atomic<std::size_t> _tail{0};
+  /// @brief Next position to pop from.
+  alignas(kCacheLineSize) std::atomic<std::size_t> _head{0};
+};
+
+}  // namespace tcp
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "socket_options.h"
+#include "thread_pool.h"
+
+namespace tcp {
+
+/// @brief What happens to the updates of connections over a rate limit, or
+/// arriving while Options::max_pending_updates are pending.
+enum class Overload {
+  /// @brief Stop reading from the connection until the update fits again,
+  /// so the client is held back by TCP flow control.
+  Pause,
+  /// @brief Reject the update: the handler's OnReject writes a reply on the
+  /// reactor and the connection is closed once the reply is out.
+  Shed,
+  /// @brief Pause like Pause, and reject new connections the same way as
+  /// Shed while the server as a whole is over its limits.
+  RejectNew,
+};
+
+/// @brief Optional server settings. The defaults keep the classic behaviour.
+struct Options {
+  /**
+   * @brief Runs one event loop per thread instead of a single event loop
+   * feeding the thread pool.
+   *
+   * Every reactor owns its epoll instance, its event vector and its own
+   * SO_REUSEPORT socket per IP listener, so the kernel spreads the incoming
+   * connections over the reactors. Unix domain listeners cannot be bound
+   * twice, so the reactors share them and the kernel wakes one at a time.
+   * A connection is served, handler calls included, by the reactor that
+   * accepted it for its whole life.
+   */
+  bool reactor_per_thread = false;
+
+  /**
+   * @brief Registers client sockets as non-blocking, edge triggered and one
+   * shot.
+   *
+   * Every wake up drains the socket until it would block and hands all of it
+   * to the handler in one update. The socket is only re-armed once the
+   * handler is done, so a connection never has two updates in flight.
+   */
+  bool edge_triggered = false;
+
+  /// @brief Backlog of pending connections of each listening socket.
+  int listen_backlog = SOMAXCONN;
+
+  /// @brief Whether IPv6 listeners refuse IPv4 connections, rather than
+  /// taking them as IPv4-mapped addresses. Needed to listen on the same port
+  /// with Address::Ipv4 and Address::Ipv6 on every interface.
+  bool v6_only = false;
+
+  /// @brief Kernel settings of the listening sockets, which the connections
+  /// they accept inherit. SocketOptions::Latency and
+  /// SocketOptions::Throughput are starting points for either tier. Sockets
+  /// taken over on a restart keep the settings they were opened with.
+  SocketOptions sockets{};
+
+  /// @brief Maximum number of connections accepted per wake up of a listening
+  /// socket, so a connection storm cannot starve reads. Must not be zero.
+  std::size_t max_accepts_per_wakeup = 64;
+
+  /**
+   * @brief Hands the thread pool the updates of one wait for events in a few
+   * batches rather than one task each.
+   *
+   * The reactor groups the updates by the lane of the thread pool their
+   * connection is posted to, and posts every batch as a single task on that
+   * lane, so a burst of events costs a handful of queue operations and wake
+   * ups. Batched and direct updates of a connection share its lane, so the
+   * affinity queue still runs them in order, and idle workers still steal
+   * lanes one at a time.
+   */
+  bool batch_dispatch = false;
+
+  /// @brief Most events a reactor waits for at once. It starts at the
+  /// server's max_events and doubles up to this whenever a wait fills it.
+  /// Values up to max_events keep it fixed.
+  std::size_t max_events_limit = 0;
+
+  /// @brief Pending response bytes past which a connection is not read from
+  /// until the client drains them.
+  std::size_t write_high_watermark = 1024 * 1024;
+
+  /// @brief Pending response bytes below which a paused connection is read
+  /// from again.
+  std::size_t write_low_watermark = 256 * 1024;
+
+  /**
+   * @brief Size from which slices added with Output::AddSlice are sent with
+   * MSG_ZEROCOPY, zero to always copy them.
+   *
+   * The kernel then pins the pages of the slice instead of copying them to
+   * the socket buffer, which only pays off for large payloads, tens of KiB
+   * and up. Files added with Output::AddFile always go out with sendfile.
+   * Only supported by the epoll backend.
+   */
+  std::size_t zerocopy_threshold = 0;
+
+  /// @brief Updates per second a single connection may send, zero for no
+  /// limit. Every read handed to the handler is an update.
+  double client_rate = 0;
+
+  /// @brief Updates a connection may send at once, on top of client_rate.
+  double client_burst = 1;
+
+  /// @brief Updates per second the whole server takes, zero for no limit.
+  /// Split evenly between the reactors, each of which keeps its own bucket.
+  double server_rate = 0;
+
+  /// @brief Updates the server takes at once, on top of server_rate. Split
+  /// like server_rate.
+  double server_burst = 1;
+
+  /// @brief Updates handed to the thread pool that did not run yet past
+  /// which the reactors stop dispatching, zero for no limit. This bounds the
+  /// queueing delay whatever the task queue.
+  std::size_t max_pending_updates = 0;
+
+  /// @brief What happens to updates over the limits above. The limits are
+  /// checked by the reactors before anything is read, and are only enforced
+  /// by the epoll backend.
+  Overload overload = Overload::Pause;
+
+  /// @brief Queue the thread pool workers take connection events from.
+  ThreadPool::Queue task_queue = ThreadPool::Queue::Locked;
+
+  /// @brief Capacity of the task queue when it is bounded, per worker for the
+  /// work-stealing queue. A reactor finding it full waits for the workers to
+  /// make room.
+  std::size_t task_queue_capacity = 4096;
+
+  /// @brief How long a connection may go without receiving or writing
+  /// anything before it is closed, zero for no limit. Connections whose
+  /// coroutine is busy are never idle.
+  std::chrono::milliseconds idle_timeout{0};
+
+  /// @brief How long a frame may take to arrive once its first bytes were
+  /// received, zero for no limit. This cuts off clients dribbling a request
+  /// in, and only applies with a framing policy.
+  std::chrono::milliseconds read_timeout{0};
+
+  /// @brief How long pending responses may wait without the client taking
+  /// any of them, zero for no limit.
+  std::chrono::milliseconds write_timeout{0};
+
+  /// @brief Granularity of the timeouts. Every reactor moves its timing
+  /// wheel forward by this much at a time. Timeouts are only enforced by the
+  /// epoll backend.
+  std::chrono::milliseconds timer_tick{10};
+
+  /**
+   * @brief CPUs to pin the reactor threads to, reactor i running on
+   * reactor_cpus[i % size]. Empty leaves them unpinned.
+   *
+   * The first reactor runs on the thread calling Run, which is pinned as
+   * well. A pinned reactor allocates its connection slots and buffers
+   * itself, so they come from its CPU's NUMA node.
+   */
+  std::vector<int> reactor_cpus{};
+
+  /// @brief CPUs to pin the thread pool workers to, worker i running on
+  /// worker_cpus[i % size]. Empty leaves them unpinned.
+  std::vector<int> worker_cpus{};
+
+  /**
+   * @brief Asks the kernel to hand every reactor the connections whose
+   * packets it processes on the reactor's CPU.
+   *
+   * With reactor_per_thread and reactor_cpus, each listening socket gets
+   * SO_INCOMING_CPU set to the CPU of its reactor. Steering every NIC receive
+   * queue's interrupts to the CPU of one reactor then keeps each connection
+   * on the CPU its packets arrive on.
+   */
+  bool incoming_cpu = false;
+
+  /// @brief Keeps the latency histograms of Server::Metrics, at the cost of
+  /// a few clock reads per update. The counters are always kept. Only
+  /// supported by the epoll backend.
+  bool metrics = false;
+
+  /// @brief How long Stop lets the pending responses drain before closing
+  /// the connections still writing them.
+  std::chrono::milliseconds drain_timeout{5000};
+
+  /**
+   * @brief Unix socket path a newer process restarting the server connects
+   * to, empty for no hot restart.
+   *
+   * The running server sends its listening sockets over it with SCM_RIGHTS.
+   * Once the newer process listens on them and tells so, the running server
+   * stops gracefully. The listening sockets never close in between, so the
+   * connections waiting in their backlogs are not dropped and clients never
+   * see the port refuse them. Only supported by the epoll backend.
+   */
+  std::string handoff_path{};
+
+  /// @brief Takes the listening sockets over from the server running on
+  /// handoff_path, if there is one, instead of opening new ones. It needs as
+  /// many reactors as that server has.
+  bool take_over = false;
+
+  /**
+   * @brief PEM certificate chain to terminate TLS with, empty for plain TCP.
+   *
+   * Reactors run the handshake with OpenSSL, which then hands the session
+   * to kernel TLS. From there on the usual read, writev and sendfile paths
+   * move plaintext while the kernel encrypts, so handlers run unchanged.
+   * Connections whose session the kernel cannot take over are closed. Needs
+   * a build with TCP_TLS and the kernel's tls module, and is only supported
+   * by the epoll backend. Unix domain listeners stay plaintext.
+   */
+  std::string tls_cert_file{};
+
+  /// @brief PEM private key of tls_cert_file.
+  std::string tls_key_file{};
+
+  /// @brief Submission queue entries of every io_uring instance, when
+  /// running on the io_uring backend.
+  unsigned uring_entries = 1024;
+
+  /// @brief Receive buffers of buf_size bytes provided to every io_uring
+  /// instance, when running on the io_uring backend.
+  std::size_t uring_recv_buffers = 1024;
+};
+
+}  // namespace tcp
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "write_queue.h"
+
+namespace tcp {
+
+template <typename Handler, typename Framing>
+class Server;
+
+template <typename Handler, typename Framing>
+class UringServer;
+
+/**
+ * @brief Response a handler builds for one update.
+ *
+ * Bytes appended to the output land in a server-owned pooled buffer that is
+ * queued for writing as is, so they are copied exactly once. Slices of
+ * memory that outlives the connection, e.g. static replies or cached files,
+ * are queued by reference and gathered into the same writev as the rest.
+ * Ranges of files are queued by descriptor and sent with sendfile, without
+ * ever being copied to user space.
+ */
+class Output {
+ public:
+  /**
+   * @brief Creates an empty output. No buffer is borrowed until something is
+   * appended.
+   * @param pool The pool to borrow the buffers from.
+   */
+  [[nodiscard]] explicit Output(BufferPool &pool) noexcept : _pool(&pool) {}
+
+  /**
+   * @brief Copies bytes to the end of the output.
+   * @param bytes The bytes.
+   */
+  void Append(std::span<const std::byte> bytes) {
+    const std::span<std::byte> dst = Extend(bytes.size());
+    std::copy(bytes.begin(), bytes.end(), dst.begin());
+  }
+
+  /**
+   * @brief Grows the output by a number of bytes for the caller to fill in,
+   * e.g. straight from a serializer.
+   * @param n The number of bytes.
+   * @return The new bytes, valid until the output is changed again.
+   */
+  [[nodiscard]] std::span<std::byte> Extend(const std::size_t n) {
+    std::vector<std::byte> &bytes = Bytes();
+    const std::size_t offset = bytes.size();
+    bytes.resize(offset + n);
+    _size += n;
+    return std::span(bytes).subspan(offset);
+  }
+
+  /**
+   * @brief Appends bytes to the output without copying them. They must stay
+   * valid and unchanged until the connection is closed.
+   * @param slice The bytes.
+   */
+  void AddSlice(std::span<const std::byte> slice) {
+    if (slice.empty()) {
+      return;
+    }
+    Seal();
+    _sealed.push_back({.owner = {}, .view = slice});
+    _size += slice.size();
+  }
+
+  /**
+   * @brief Appends a range of a file to the output without reading it, e.g.
+   * a large static payload. The descriptor must stay open and the range
+   * unchanged until the connection is closed. Since sendfile cannot opt out
+   * of SIGPIPE, the first file sent makes the process ignore it, unless the
+   * application installed a handler of its own.
+   * @param fd The file.
+   * @param offset Where the range starts in the file.
+   * @param length The number of bytes of the range.
+   */
+  void AddFile(const int fd, const off_t offset, const std::size_t length) {
+    if (length == 0) {
+      return;
+    }
+    Seal();
+    _sealed.push_back({.owner = {}, .view = {}, .file = fd, .file_offset = offset, .file_size = length});
+    _size += length;
+  }
+
+  /**
+   * @brief Returns the number of bytes in the output.
+   * @return The size of the output.
+   */
+  [[nodiscard]] std::size_t size() const noexcept { return _size; }
+
+  /**
+   * @brief Returns whether the output is empty.
+   * @return Whether the output is empty.
+   */
+  [[nodiscard]] bool empty() const noexcept { return _size == 0; }
+
+ private:
+  template <typename Handler, typename Framing>
+  friend class Server;
+  template <typename Handler, typename Framing>
+  friend class UringServer;
+
+  /**
+   * @brief Returns the buffer being appended to, borrowing one if needed.
+   * Handlers still built on vectors write to it directly.
+   * @return The buffer being appended to.
+   */
+  [[nodiscard]] std::vector<std::byte> &Bytes() {
+    if (!_buf) {
+      _buf = _pool->AcquireEmpty();
+    }
+    return *_buf;
+  }
+
+  /**
+   * @brief Queues the whole output for writing, leaving it empty.
+   * @param queue The queue of the connection.
+   */
+  void MoveTo(WriteQueue &queue) {
+    Seal();
+    for (WriteQueue::Chunk &chunk : _sealed) {
+      queue.Push(std::move(chunk));
+    }
+    _sealed.clear();
+    _size = 0;
+  }
+
+  /**
+   * @brief Ends the buffer being appended to, so whatever comes next goes
+   * after it.
+   */
+  void Seal() {
+    if (_buf && !_buf->empty()) {
+      const std::span<const std::byte> view(*_buf);
+      _sealed.push_back({.owner = std::move(_buf), .view = view});
+    }
+  }
+
+  /// @brief The pool to borrow the buffers from.
+  BufferPool *_pool;
+  /// @brief The buffer being appended to, if any.
+  BufferPool::Buffer _buf;
+  /// @brief The chunks before the buffer being appended to, only used once
+  /// a slice was added.
+  std::vector<WriteQueue::Chunk> _sealed;
+  /// @brief The number of bytes in the output.
+  std::size_t _size{0};
+};
+
+}  // namespace tcp
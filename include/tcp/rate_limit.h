@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+namespace tcp {
+
+/**
+ * @brief Token bucket refilled continuously at a fixed rate, up to a burst.
+ *
+ * Refills lazily from the time points it is given, so it never reads the
+ * clock itself. Not thread safe, the reactor owning it is its only user.
+ */
+class TokenBucket {
+ public:
+  /// @brief The clock of the time points.
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Creates an unlimited bucket.
+   */
+  TokenBucket() noexcept = default;
+
+  /**
+   * @brief Creates a full bucket.
+   * @param rate The tokens added per second, zero for no limit.
+   * @param burst The most tokens the bucket holds, at least one.
+   * @param now The current time.
+   */
+  [[nodiscard]] TokenBucket(const double rate, const double burst, const Clock::time_point now) noexcept
+      : _rate(rate), _burst(std::max(burst, 1.0)), _tokens(_burst), _last(now) {}
+
+  /**
+   * @brief Returns whether a token can be taken, refilling the bucket first.
+   * @param now The current time.
+   * @return Whether a token is available.
+   */
+  [[nodiscard]] bool Ready(const Clock::time_point now) noexcept {
+    if (_rate == 0) {
+      return true;
+    }
+    if (now > _last) {
+      const std::chrono::duration<double> elapsed = now - _last;
+      _tokens = std::min(_burst, _tokens + elapsed.count() * _rate);
+      _last = now;
+    }
+    return _tokens >= 1;
+  }
+
+  /**
+   * @brief Takes a token, which Ready must have found.
+   */
+  void Take() noexcept {
+    if (_rate != 0) {
+      _tokens -= 1;
+    }
+  }
+
+ private:
+  /// @brief The tokens added per second, zero for no limit.
+  double _rate{0};
+  /// @brief The most tokens the bucket holds.
+  double _burst{1};
+  /// @brief The tokens in the bucket.
+  double _tokens{1};
+  /// @brief When the bucket was last refilled.
+  Clock::time_point _last{};
+};
+
+}  // namespace tcp
@@ -2,27 +2,83 @@
 
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <coroutine>
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <span>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "address.h"
+#include "buffer_pool.h"
+#include "connection.h"
+#include "connection_table.h"
+#include "coro.h"
+#include "framing.h"
+#include "handler.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "options.h"
+#include "output.h"
+#include "rate_limit.h"
 #include "thread_pool.h"
+#include "timer_wheel.h"
 #include "utils.h"
+#include "write_queue.h"
+
+#ifdef TCP_TLS
+#include "tls.h"
+#endif
 
 namespace tcp {
 
 /**
  * @brief TCP server. Accepts new connections and handles using a provided
  * handler.
+ *
+ * With a framing policy other than RawFraming, the bytes received are
+ * reassembled into frames and OnRead gets one complete frame at a time. All
+ * the frames of one read are handed over in a single update.
+ *
+ * With a coroutine handler, every connection runs one OnRead coroutine at a
+ * time. The coroutine may wait on the connection's frames, on room in its
+ * write queue or on a timer of its reactor, and is resumed by the thread pool
+ * once the wait is over.
+ *
+ * Idle, read and write timeouts are kept on a timing wheel per reactor. The
+ * connections only record when they last made progress, the reactor checks
+ * them when their timer expires and moves the timer to the next deadline.
+ *
+ * Stop shuts the server down gracefully: the reactors stop accepting and
+ * reading, let the updates already handed to the thread pool finish and the
+ * pending responses drain, then Run returns. With Options::handoff_path a
+ * newer process can take the listening sockets over and stop this one the
+ * same way, without the port ever refusing a connection.
  * @tparam Handler The handler type.
+ * @tparam Framing The framing policy.
  */
-template <typename Handler>
+template <typename Handler, typename Framing = RawFraming>
 class Server {
+  static_assert(ConnectionHandler<Handler>, "Handler must provide OnRead with span or vector buffers");
+  static_assert(FramingPolicy<Framing>, "Framing must provide FrameSize and Payload");
+
  private:
   ///@brief Kind of connection update to handle.
   enum UpdateKind {
@@ -32,234 +88,2607 @@ class Server {
     Read,
   };
 
+  /// @brief Whether the handler reads spans of exactly the bytes received,
+  /// rather than null terminated receive buffers.
+  static constexpr bool kSpanRead = SpanReadHandler<Handler>;
+
+  /// @brief Whether the handler reads frames in coroutines.
+  static constexpr bool kAsync = AsyncReadHandler<Handler>;
+
+  /// @brief Whether the handler's callbacks run on the reactor threads.
+  static constexpr bool kInline = InlineHandler<Handler>;
+
+  /// @brief Whether the bytes received are reassembled into frames.
+  static constexpr bool kFramed = !std::is_same_v<Framing, RawFraming>;
+  static_assert(!kFramed || kSpanRead || kAsync, "Framed servers need a handler reading spans");
+
+  /// @brief The clock of the timers.
+  using Clock = std::chrono::steady_clock;
+
+  struct ConnectionState;
+
+  /// @brief Shared handle on the state of a connection.
+  using ConnPtr = std::shared_ptr<ConnectionState>;
+
+  /// @brief Table of the connections of a reactor.
+  using Table = ConnectionTable<ConnPtr>;
+
+  /// @brief A timer a coroutine waits on.
+  struct Timer {
+    /// @brief When the timer expires.
+    Clock::time_point deadline;
+    /// @brief The connection of the coroutine.
+    ConnPtr conn;
+    /// @brief The wait the timer ends, later waits ignore it.
+    std::uint64_t wait_id;
+
+    /**
+     * @brief Orders the timers by deadline.
+     * @param other The other timer.
+     * @return Whether this timer expires after the other one.
+     */
+    bool operator>(const Timer &other) const noexcept { return deadline > other.deadline; }
+  };
+
+  /// @brief A coroutine whose wait is over.
+  struct Wake {
+    /// @brief The connection of the coroutine.
+    ConnPtr conn;
+    /// @brief The coroutine.
+    std::coroutine_handle<> handle;
+  };
+
+  /// @brief An event loop with its own epoll instance and listening socket.
+  struct Reactor {
+    /**
+     * @brief Creates a reactor, with nothing opened yet.
+     * @param buf_size The size of the receive buffers.
+     */
+    explicit Reactor(const std::size_t buf_size) : recv_buffers(buf_size), send_buffers(buf_size) {}
+
+    /// @brief The epoll instance's file descriptor.
+    int epoll_fd{-1};
+    /// @brief The listening sockets, one per listener of the server.
+    std::vector<int> server_fds;
+    /// @brief Wakes the reactor up when a coroutine is woken or a timer armed
+    /// from another thread.
+    int event_fd{-1};
+
+    /// @brief Recycled receive buffers of the reactor's connections, all of
+    /// them buf_size bytes long. Filled by the reactor, so they live on its
+    /// NUMA node once it is pinned. Declared before every member holding
+    /// connections, whose buffers go back to the pools when they are freed.
+    BufferPool recv_buffers;
+    /// @brief Recycled send buffers of the reactor's connections.
+    BufferPool send_buffers;
+
+    /// @brief Guards everything below.
+    std::mutex mutex;
+    /// @brief The timers of the coroutines, soonest first.
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+    /// @brief The coroutines to resume.
+    std::vector<Wake> wakes;
+    /// @brief When the reactor wakes up on its own, so earlier timers must
+    /// wake it up through the event descriptor. The earliest time point while
+    /// it is awake.
+    Clock::time_point sleeping_until{Clock::time_point::min()};
+    /// @brief The connections closed since the reactor last woke up, linked
+    /// through ConnectionState::next_closed. Their sockets are only closed by
+    /// the reactor, so their descriptors cannot be reused before it forgot
+    /// them.
+    ConnPtr closed;
+
+    /// @brief The open connections. Only touched by the reactor.
+    Table conns;
+    /// @brief The reactor's share of Options::server_rate. Only touched by
+    /// the reactor.
+    TokenBucket bucket;
+    /// @brief The connections not read from until their updates fit the
+    /// limits again. Only touched by the reactor.
+    std::vector<ConnPtr> throttled;
+    /// @brief Whether updates dispatched by the reactor are batched rather
+    /// than posted right away. Only touched by the reactor.
+    bool batching{false};
+    /// @brief The updates batched since the wait for events returned, one
+    /// batch per lane of the thread pool. Only touched by the reactor.
+    std::vector<std::vector<Task>> batches;
+    /// @brief The lanes whose batches are not empty, in the order they were
+    /// started. Only touched by the reactor.
+    std::vector<std::size_t> batched;
+    /// @brief The timeouts of the connections. Only touched by the reactor.
+    TimerWheel wheel;
+    /// @brief When the last wait for events returned. Only touched by the
+    /// reactor.
+    Clock::time_point now{Clock::now()};
+    /// @brief The metrics of the reactor thread.
+    ThreadMetrics metrics;
+    /// @brief Whether the reactor is shutting down. Only touched by the
+    /// reactor.
+    bool draining{false};
+    /// @brief When the connections still writing are closed while shutting
+    /// down. Only touched by the reactor.
+    Clock::time_point drain_deadline{};
+  };
+
+  /// @brief What a coroutine waits on.
+  enum class Wait {
+    /// @brief Nothing, it is running or ready to run.
+    None,
+    /// @brief The next frame.
+    Read,
+    /// @brief Room in the write queue.
+    Write,
+    /// @brief A timer.
+    Sleep,
+    /// @brief Anything, only used to wake it up whatever it waits on.
+    Any,
+  };
+
+  /// @brief Bytes received for a coroutine handler.
+  struct Input {
+    /// @brief The receive buffer.
+    BufferPool::Buffer buf;
+    /// @brief The number of bytes of complete frames in the buffer.
+    std::size_t len;
+    /// @brief Where the next frame starts.
+    std::size_t offset;
+  };
+
+  /// @brief State of the coroutine handling a connection, guarded by the
+  /// connection's mutex except for what only the running coroutine touches.
+  struct AsyncState {
+    /**
+     * @brief Creates the state of a connection without a coroutine.
+     * @param server The server.
+     * @param conn The connection.
+     */
+    AsyncState(Server &server, ConnectionState &conn) noexcept : out(conn.reactor.send_buffers), io(&server, &conn, kIoOps) {}
+
+    /// @brief The frames received and not handled yet.
+    std::deque<Input> inputs;
+    /// @brief The coroutine, only touched by the thread running it.
+    Async<bool> task;
+    /// @brief The response of the coroutine, only touched by the thread
+    /// running it.
+    Output out;
+    /// @brief The I/O the coroutine waits on.
+    Io io;
+    /// @brief The handler of the thread running the coroutine.
+    Handler *handler{nullptr};
+    /// @brief The suspended coroutine, while it waits.
+    std::coroutine_handle<> handle;
+    /// @brief Counts the waits, so timers of earlier ones are ignored.
+    std::uint64_t wait_id{0};
+    /// @brief What the coroutine waits on.
+    Wait wait{Wait::None};
+    /// @brief Whether a coroutine is handling the connection.
+    bool busy{false};
+    /// @brief Whether a thread is running or about to resume the coroutine.
+    bool running{false};
+    /// @brief Whether the wait ended while the coroutine was still running.
+    bool ready{false};
+    /// @brief Whether the client closed its side.
+    bool eof{false};
+  };
+
+  /// @brief Stand-in for the coroutine state of synchronous handlers.
+  struct NoAsyncState {
+    NoAsyncState(Server &, ConnectionState &) noexcept {}
+  };
+
+  /// @brief The handler's per-connection data.
+  using Session = typename SessionOf<Handler>::type;
+
+  /// @brief State of an open connection, shared by the reactor and the tasks
+  /// handling it. The handler only sees the Connection part.
+  struct ConnectionState : Connection<Session>, std::enable_shared_from_this<ConnectionState>, TimerWheel::Node {
+    /**
+     * @brief Creates the state of a new connection.
+     * @param client_fd The client socket.
+     * @param client_addr The client address.
+     * @param owner The reactor serving it.
+     * @param server The server.
+     */
+    ConnectionState(const int client_fd, const Address &client_addr, Reactor &owner, Server &server) noexcept
+        : Connection<Session>(client_fd, client_addr), reactor(owner), async(server, *this) {}
+
+    /// @brief The reactor serving the connection.
+    Reactor &reactor;
+    /// @brief The key of the connection in the reactor's table, which its
+    /// epoll events carry. Set before the connection is shared.
+    std::uint64_t key{0};
+
+    /// @brief The start of a frame whose rest was not received yet. Only
+    /// touched by the reactor.
+    BufferPool::Buffer partial;
+    /// @brief When the last bytes were received. Only touched by the reactor.
+    Clock::time_point last_read;
+    /// @brief The connection's Options::client_rate. Only touched by the
+    /// reactor.
+    TokenBucket bucket;
+#ifdef TCP_TLS
+    /// @brief The TLS session while its handshake runs, freed once the
+    /// kernel took it over. Only touched by the reactor.
+    TlsSession tls;
+#endif
+    /// @brief When the first bytes of the partial frame were received. Only
+    /// touched by the reactor.
+    Clock::time_point partial_since;
+    /// @brief When the last update of the connection was handed to the
+    /// thread pool, if Options::metrics is set. Updates overlapping on a level
+    /// triggered socket share it.
+    std::atomic<Clock::rep> dispatched_at{0};
+
+    /// @brief Guards everything below. Starts a new cache line, away from
+    /// the fields only the reactor touches.
+    alignas(kCacheLineSize) std::mutex mutex;
+    /// @brief Responses the socket did not take yet.
+    WriteQueue out;
+    /// @brief The events the socket is registered for.
+    std::uint32_t events{EPOLLIN};
+    /// @brief Whether reading is paused until the responses drain.
+    bool read_paused{false};
+    /// @brief Whether reading is paused until the updates fit the limits.
+    bool throttled{false};
+    /// @brief Whether to close the connection once the responses drain.
+    bool closing{false};
+    /// @brief When the oldest pending response was queued, if Options::metrics
+    /// is set.
+    Clock::time_point write_since{};
+    /// @brief Whether the connection was closed.
+    bool closed{false};
+    /// @brief Whether the server is stopping, so nothing more is read and the
+    /// close is reported to the handler once the responses drained.
+    bool stopping{false};
+    /// @brief When the responses last made progress, or started waiting.
+    Clock::time_point last_write;
+    /// @brief The next connection closed on the same reactor, guarded by the
+    /// reactor's mutex.
+    ConnPtr next_closed;
+    /// @brief The coroutine handling the connection, if the handler reads in
+    /// coroutines.
+    [[no_unique_address]] std::conditional_t<kAsync, AsyncState, NoAsyncState> async;
+  };
+
  public:
   /**
-   * @brief Creates a new server.
+   * @brief Creates a new server listening on a port of every IPv4 interface.
    * @param port The port to listen on.
-   * @param threads The number of threads to use.
+   * @param threads The number of threads to use. With
+   * Options::reactor_per_thread this is the number of reactors, otherwise
+   * the number of workers, none for handlers dispatched inline.
    * @param buf_size The buffer size for the receive operation in each
    * connection.
    * @param max_events The maximum number of events to wait for.
+   * @param options Optional server settings.
    */
   [[nodiscard]] Server(std::uint16_t port, std::size_t threads,
-                       std::size_t buf_size, int max_events)
-      : _epoll_fd(epoll_create1(0)),
-        _port(port), _buf_size(buf_size), _max_events(max_events),
-        _server_fd(socket(AF_INET, SOCK_STREAM, 0)), _thread_pool(threads) {
+                       std::size_t buf_size, int max_events,
+                       const Options &options = {})
+      : Server(std::vector<Address>{Address::Ipv4(port)}, threads, buf_size, max_events, options) {}
+
+  /**
+   * @brief Creates a new server listening on several addresses, of any
+   * family. Every reactor accepts on all of them.
+   * @param listeners The addresses to listen on.
+   * @param threads The number of threads to use. With
+   * Options::reactor_per_thread this is the number of reactors, otherwise
+   * the number of workers, none for handlers dispatched inline.
+   * @param buf_size The buffer size for the receive operation in each
+   * connection.
+   * @param max_events The maximum number of events to wait for.
+   * @param options Optional server settings.
+   */
+  [[nodiscard]] Server(std::vector<Address> listeners, std::size_t threads,
+                       std::size_t buf_size, int max_events,
+                       const Options &options = {})
+      : _listeners(std::move(listeners)), _buf_size(buf_size), _max_events(max_events),
+        _options(options),
+        _thread_pool(kInline || options.reactor_per_thread ? 0 : threads, options.task_queue,
+                     options.task_queue_capacity, options.worker_cpus) {
     // Check if the max_events is valid.
     if (max_events <= 0) {
       throw Error("Invalid max events.", Error::Kind::EpollCreation);
     }
 
-    // Check if epoll was created successfully
-    if (_epoll_fd == -1) {
-      throw Error("Failed to create epoll instance.", Error::Kind::EpollCreation);
+    // Check if there is anything to listen on
+    if (_listeners.empty()) {
+      throw Error("No address to listen on.", Error::Kind::SocketBinding);
+    }
+
+    // Give every worker its own metrics
+    _worker_metrics = std::make_unique<ThreadMetrics[]>(_thread_pool.Size());
+
+    // Check if every wake up of a listening socket may accept something
+    if (_options.max_accepts_per_wakeup == 0) {
+      throw Error("Invalid accept batch size.", Error::Kind::SocketListening);
     }
 
-    // Check if the server socket was created successfully
-    if (_server_fd == -1) {
-      throw Error("Failed to create server socket.", Error::Kind::SocketCreation);
+    // Check if there is at least one thread to run the reactors on
+    if (_options.reactor_per_thread && threads == 0) {
+      throw Error("Invalid number of reactors.", Error::Kind::EpollCreation);
     }
 
-    // Set socket options
-    const int opt = 1;
-    if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-      throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+    // Check if the timeouts can be kept
+    for (const std::chrono::milliseconds timeout : {_options.idle_timeout, _options.read_timeout, _options.write_timeout}) {
+      if (timeout < std::chrono::milliseconds::zero()) {
+        throw Error("Invalid timeout.", Error::Kind::EpollCreation);
+      } else if (timeout > std::chrono::milliseconds::zero() &&
+                 (_min_timeout == std::chrono::milliseconds::zero() || timeout < _min_timeout)) {
+        _min_timeout = timeout;
+      }
+    }
+    if ((_min_timeout > std::chrono::milliseconds::zero() || HasLimits()) &&
+        _options.timer_tick <= std::chrono::milliseconds::zero()) {
+      throw Error("Invalid timer tick.", Error::Kind::EpollCreation);
+    }
+
+    // Load the certificate to terminate TLS with
+    if (!_options.tls_cert_file.empty()) {
+#ifdef TCP_TLS
+      _tls = std::make_unique<TlsContext>(_options.tls_cert_file, _options.tls_key_file);
+#else
+      throw Error("TLS support was not built, see TCP_TLS.", Error::Kind::Tls);
+#endif
+    }
+
+    // Check if the limits make sense
+    if (_options.client_rate < 0 || _options.server_rate < 0) {
+      throw Error("Invalid rate limit.", Error::Kind::EpollCreation);
+    }
+
+    // Check if the reactors can run where they are asked to
+    for (const int cpu : _options.reactor_cpus) {
+      if (!IsCpuAvailable(cpu)) {
+        throw Error("Invalid reactor CPU.", Error::Kind::ThreadAffinity);
+      }
     }
 
-    // Bind the socket to an address and port
-    sockaddr_in server_addr{};
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_family = AF_INET, server_addr.sin_port = htons(_port);
-    if (bind(_server_fd, reinterpret_cast<const sockaddr *>(&server_addr), sizeof(server_addr)) == -1) {
-      throw Error("Failed to bind server socket.", Error::Kind::SocketBinding);
+    // Open the reactors on the listening sockets of the server being
+    // restarted if any, closing whatever was opened if anything fails
+    const std::size_t num_reactors = _options.reactor_per_thread ? threads : 1;
+    std::vector<int> inherited;
+    try {
+      if (_options.take_over && !_options.handoff_path.empty()) {
+        inherited = TakeOver(num_reactors * _listeners.size());
+      }
+      for (std::size_t i = 0; i < num_reactors; ++i) {
+        std::vector<int> sockets;
+        if (!inherited.empty()) {
+          const auto first = inherited.begin() + static_cast<std::ptrdiff_t>(i * _listeners.size());
+          sockets.assign(first, first + static_cast<std::ptrdiff_t>(_listeners.size()));
+        }
+        OpenReactor(_reactors.emplace_back(_buf_size), ReactorCpu(i), std::move(sockets));
+        _reactors.back().bucket = TokenBucket(_options.server_rate / static_cast<double>(num_reactors),
+                                              _options.server_burst / static_cast<double>(num_reactors), Clock::now());
+      }
+
+      // Let the next restart take the sockets over in turn
+      if (!_options.handoff_path.empty()) {
+        _handoff_fd = OpenHandoffSocket(_options.handoff_path);
+      }
+    } catch (const Error &) {
+      for (std::size_t i = _reactors.size() * _listeners.size(); i < inherited.size(); ++i) {
+        close(inherited[i]);
+      }
+      CloseReactors();
+      throw;
     }
   }
 
   /**
-   * @brief Closes the sever's socket and epoll instance.
+   * @brief Closes the server's sockets and epoll instances, and stops the
+   * thread pool.
+   *
+   * Once Run returned after Stop there is nothing left to run: the reactors
+   * post their batches before every drain step and only return once every
+   * update handed to the pool ran. If Run ended with an error instead, the
+   * updates still batched or queued may be dropped without running.
    */
   ~Server() noexcept {
-    close(_epoll_fd);
-    close(_server_fd);
+    // Connection tasks borrow the buffers of the reactors
+    _thread_pool.Stop();
+    CloseReactors();
   }
 
   /**
-   * @brief Runs the server.
+   * @brief Runs the server with a handler shared by all threads.
+   *
+   * With Options::reactor_per_thread every reactor but the first one gets its
+   * own thread, the first one runs on the calling thread. An error escaping a
+   * reactor thread other than the calling one terminates the process, one on
+   * the calling thread stops the other reactors before Run throws it.
+   * Returns once the server was stopped, a stopped server cannot run again.
    * @param handler The handler for the server.
    */
-  [[noreturn]] void Run(Handler &handler) {
-    // Listen for incoming connections
-    if (listen(_server_fd, SOMAXCONN) == -1) {
-      throw Error("Failed to listen on server socket.", Error::Kind::SocketListening);
+  void Run(Handler &handler) {
+    _shared_handler = &handler;
+    RunReactors([&handler](std::size_t) -> Handler & { return handler; });
+  }
+
+  /**
+   * @brief Runs the server with one handler per thread, so handlers can keep
+   * thread-local state without locking.
+   *
+   * Every thread pool worker and every reactor gets its own handler, built by
+   * the factory before any connection is accepted. Updates always run on the
+   * handler of the thread running them. Returns once the server was stopped.
+   * @param factory Creates a handler each time it is called.
+   */
+  template <typename Factory>
+    requires(!std::is_same_v<std::remove_cvref_t<Factory>, Handler> && std::is_invocable_r_v<Handler, Factory &>)
+  void Run(Factory &&factory) {
+    // One handler per pool worker, then one per reactor
+    const std::size_t num_handlers = _thread_pool.Size() + _reactors.size();
+    _handlers.reserve(num_handlers);
+    for (std::size_t i = 0; i < num_handlers; ++i) {
+      _handlers.emplace_back(new Handler(factory()));
+    }
+
+    RunReactors([this](std::size_t i) -> Handler & { return *_handlers[_thread_pool.Size() + i]; });
+  }
+
+  /**
+   * @brief Stops the server gracefully, from any thread, a signal handler
+   * included.
+   *
+   * The reactors close their listening sockets and stop reading. Once the
+   * updates handed to the thread pool ran, the idle connections are closed
+   * and the others once their responses drained, closing the ones still
+   * writing after Options::drain_timeout. The handler gets an OnClose for
+   * every connection closed on the way. Run returns once every connection
+   * is gone, so it waits for callbacks still running.
+   */
+  void Stop() noexcept {
+    _stopping.store(true, std::memory_order_release);
+    WakeReactors();
+  }
+
+  /**
+   * @brief Adds up the metrics of every thread, from any thread while the
+   * server runs. The counters are always kept, the latency histograms only
+   * with Options::metrics.
+   * @return The metrics so far.
+   */
+  [[nodiscard]] MetricsSnapshot Metrics() {
+    MetricsSnapshot snapshot;
+    for (const Reactor &reactor : _reactors) {
+      reactor.metrics.MergeInto(snapshot);
+    }
+    for (std::size_t i = 0; i < _thread_pool.Size(); ++i) {
+      _worker_metrics[i].MergeInto(snapshot);
+    }
+    snapshot.queued = _thread_pool.Pending();
+    return snapshot;
+  }
+
+ private:
+  /**
+   * @brief Starts listening and runs the reactors.
+   * @param reactor_handler Returns the handler of each reactor thread.
+   */
+  template <typename F>
+  void RunReactors(F &&reactor_handler) {
+    for (Reactor &reactor : _reactors) {
+      for (std::size_t i = 0; i < reactor.server_fds.size(); ++i) {
+        // Listen for incoming connections
+        const int server_fd = reactor.server_fds[i];
+        if (listen(server_fd, _options.listen_backlog) == -1) {
+          throw Error("Failed to listen on server socket.", Error::Kind::SocketListening);
+        }
+
+        // Add the server socket to the epoll instance, waking a single
+        // reactor up for the sockets they share
+        const bool shared = _reactors.size() > 1 && _listeners[i].Family() == AF_UNIX;
+        epoll_event server_event = {.events = EPOLLIN | (shared ? EPOLLEXCLUSIVE : 0u),
+                                    .data = {.u64 = Table::Key(server_fd, 0)}};
+        if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, server_fd, &server_event) == -1) {
+          throw Error("Failed to add server socket to epoll instance.", Error::Kind::EpollAdd);
+        }
+      }
+
+      // Add the event descriptor waking the reactor up
+      epoll_event wake_event = {.events = EPOLLIN, .data = {.u64 = Table::Key(reactor.event_fd, 0)}};
+      if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.event_fd, &wake_event) == -1) {
+        throw Error("Failed to add event descriptor to epoll instance.", Error::Kind::EpollAdd);
+      }
+    }
+
+    // The first reactor waits for the next restart
+    if (_handoff_fd != -1) {
+      epoll_event handoff_event = {.events = EPOLLIN, .data = {.u64 = Table::Key(_handoff_fd, 0)}};
+      if (epoll_ctl(_reactors.front().epoll_fd, EPOLL_CTL_ADD, _handoff_fd, &handoff_event) == -1) {
+        throw Error("Failed to add hand-off socket to epoll instance.", Error::Kind::EpollAdd);
+      }
+    }
+
+    // Tell the server being restarted its sockets are listened on, it stops
+    // once it reads this
+    if (_predecessor_fd != -1) {
+      const char ack = 'A';
+      static_cast<void>(send(_predecessor_fd, &ack, 1, MSG_NOSIGNAL));
+      close(std::exchange(_predecessor_fd, -1));
+    }
+
+    std::vector<std::thread> reactor_threads;
+    try {
+      // Start the other reactors on their own threads
+      for (std::size_t i = 1; i < _reactors.size(); ++i) {
+        reactor_threads.emplace_back([this, &handler = reactor_handler(i), i] {
+          PinReactor(i);
+          RunReactor(_reactors[i], handler);
+        });
+      }
+
+      // The first reactor runs on the calling thread
+      PinReactor(0);
+      RunReactor(_reactors.front(), reactor_handler(0));
+    } catch (...) {
+      // Wind the reactors already started down before passing the error on
+      Stop();
+      for (std::thread &thread : reactor_threads) {
+        thread.join();
+      }
+      throw;
+    }
+    for (std::thread &thread : reactor_threads) {
+      thread.join();
+    }
+  }
+
+  /**
+   * @brief Connects to the server being restarted, if one listens on the
+   * hand-off path, and receives its listening sockets. It keeps running
+   * until told they are listened on.
+   * @param num_sockets The number of listening sockets of all reactors, which
+   * must match the number of sockets received.
+   * @return The listening sockets, reactor by reactor, none if no server is
+   * running.
+   */
+  [[nodiscard]] std::vector<int> TakeOver(const std::size_t num_sockets) {
+    _predecessor_fd = ConnectHandoff(_options.handoff_path);
+    if (_predecessor_fd == -1) {
+      return {};
+    }
+    std::vector<int> inherited = ReceiveSockets(_predecessor_fd);
+    if (inherited.size() != num_sockets) {
+      for (const int fd : inherited) {
+        close(fd);
+      }
+      throw Error("Inherited listening sockets do not match the reactors.", Error::Kind::Handoff);
+    }
+    return inherited;
+  }
+
+  /**
+   * @brief Sends the listening sockets to a newer process connecting to the
+   * hand-off socket, unless another one is taking them over already or the
+   * server is stopping.
+   * @param reactor The first reactor, waiting for the restarts.
+   */
+  void AcceptSuccessor(Reactor &reactor) {
+    const int fd = accept4(_handoff_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      return;
+    }
+
+    // Send the sockets, then wait for it to listen on them
+    bool sent = false;
+    if (_successor_fd == -1) {
+      std::lock_guard<std::mutex> lock(_listen_mutex);
+      std::vector<int> sockets;
+      for (const Reactor &each : _reactors) {
+        sockets.insert(sockets.end(), each.server_fds.begin(), each.server_fds.end());
+      }
+      sent = !_stopping.load(std::memory_order_acquire) && SendSockets(fd, sockets);
+    }
+    epoll_event successor_event = {.events = EPOLLIN, .data = {.u64 = Table::Key(fd, 0)}};
+    if (!sent || epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &successor_event) == -1) {
+      close(fd);
+      return;
+    }
+    _successor_fd = fd;
+  }
+
+  /**
+   * @brief Stops the server once the newer process listens on its sockets,
+   * or keeps serving if it went away before.
+   */
+  void FinishHandoff() noexcept {
+    char ack = 0;
+    const ssize_t n = recv(_successor_fd, &ack, 1, 0);
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return;
+    }
+    close(std::exchange(_successor_fd, -1));
+    if (n == 1) {
+      _handed_off = true;
+      Stop();
+    }
+  }
+
+  /**
+   * @brief Returns the CPU a reactor is pinned to.
+   * @param index The index of the reactor.
+   * @return The CPU, -1 if the reactor is not pinned.
+   */
+  [[nodiscard]] int ReactorCpu(const std::size_t index) const noexcept {
+    const std::vector<int> &cpus = _options.reactor_cpus;
+    return cpus.empty() ? -1 : cpus[index % cpus.size()];
+  }
+
+  /**
+   * @brief Pins the calling thread to the CPU of a reactor, if it has one.
+   * @param index The index of the reactor.
+   */
+  void PinReactor(const std::size_t index) const {
+    if (const int cpu = ReactorCpu(index); cpu != -1 && !PinThread(cpu)) {
+      throw Error("Failed to pin a reactor thread.", Error::Kind::ThreadAffinity);
+    }
+  }
+
+  /**
+   * @brief Creates an epoll instance, an event descriptor and a bound server
+   * socket per listener. Whatever was opened before an error is closed with
+   * the reactors.
+   * @param reactor The reactor to open, the last one.
+   * @param cpu The CPU the reactor is pinned to, -1 if none.
+   * @param inherited The listening sockets taken over from the server being
+   * restarted, none to open new ones.
+   */
+  void OpenReactor(Reactor &reactor, const int cpu, std::vector<int> inherited) const {
+    // The reactor owns the inherited sockets whatever happens next
+    reactor.server_fds = std::move(inherited);
+
+    // Check if epoll was created successfully
+    reactor.epoll_fd = epoll_create1(0);
+    if (reactor.epoll_fd == -1) {
+      throw Error("Failed to create epoll instance.", Error::Kind::EpollCreation);
+    }
+
+    // Check if the event descriptor was created successfully
+    reactor.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor.event_fd == -1) {
+      throw Error("Failed to create event descriptor.", Error::Kind::EpollCreation);
+    }
+
+    for (std::size_t i = reactor.server_fds.size(); i < _listeners.size(); ++i) {
+      // Open the server socket, every reactor has its own with SO_REUSEPORT.
+      // Unix domain sockets cannot share a path, so the first reactor's one
+      // is shared instead
+      const Address &addr = _listeners[i];
+      if (addr.Family() == AF_UNIX && &reactor != &_reactors.front()) {
+        const int server_fd = fcntl(_reactors.front().server_fds[i], F_DUPFD_CLOEXEC, 0);
+        if (server_fd == -1) {
+          throw Error("Failed to share server socket.", Error::Kind::SocketCreation);
+        }
+        reactor.server_fds.push_back(server_fd);
+        continue;
+      }
+      reactor.server_fds.push_back(OpenServerSocket(addr, _options.reactor_per_thread, _options.v6_only));
+      ApplyListenerOptions(reactor.server_fds.back(), addr.Family(), _options.sockets);
+
+      // Ask for the connections whose packets are processed on the reactor's
+      // CPU
+      if (_options.incoming_cpu && _options.reactor_per_thread && cpu != -1 &&
+          setsockopt(reactor.server_fds.back(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+        throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+      }
+    }
+  }
+
+  /**
+   * @brief Closes the sockets and epoll instances of all reactors, and the
+   * hand-off sockets.
+   */
+  void CloseReactors() noexcept {
+    for (const Reactor &reactor : _reactors) {
+      for (const int fd : {reactor.epoll_fd, reactor.event_fd}) {
+        if (fd != -1) {
+          close(fd);
+        }
+      }
+      for (const int fd : reactor.server_fds) {
+        close(fd);
+      }
+    }
+    _reactors.clear();
+    for (int *fd : {&_handoff_fd, &_predecessor_fd, &_successor_fd}) {
+      if (*fd != -1) {
+        close(std::exchange(*fd, -1));
+      }
+    }
+  }
+
+  /**
+   * @brief Wakes every reactor up, from any thread or a signal handler.
+   */
+  void WakeReactors() noexcept {
+    for (const Reactor &reactor : _reactors) {
+      eventfd_write(reactor.event_fd, 1);
+    }
+  }
+
+  /**
+   * @brief Hands a connection task to the thread pool, or runs it right away
+   * when every reactor serves its own connections or the handler is
+   * dispatched inline.
+   *
+   * The task is keyed by the connection's socket, so with the affinity queue
+   * the updates of a connection run in order on the same worker. Tasks are
+   * counted until they ran, so stopping knows when the queued work is done.
+   * @param handler The handler of the calling thread.
+   * @param conn The connection.
+   * @param task The task to run, given the handler of the thread running it.
+   */
+  template <typename F>
+  void Dispatch(Handler &handler, ConnectionState &conn, F &&task) {
+    // Time the hand over from the wait returning, which only the reactor
+    // knows
+    if (_options.metrics) {
+      const Clock::time_point now = Clock::now();
+      if (ThreadPool::CurrentWorker() == ThreadPool::npos) {
+        conn.reactor.metrics.dispatch_latency.Record(Nanoseconds(now - conn.reactor.now));
+      }
+      if (!IsInline()) {
+        conn.dispatched_at.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+      }
+    }
+
+    const auto key = static_cast<std::size_t>(conn.fd);
+    if (IsInline()) {
+      task(handler);
+      return;
+    }
+    _in_flight.fetch_add(1, std::memory_order_relaxed);
+
+    // Batch the updates of the reactor, posted once the events are handled
+    // on the lane the update would have been posted to, so it keeps its order
+    // with the updates posted directly
+    if (ThreadPool::CurrentWorker() == ThreadPool::npos && conn.reactor.batching) {
+      const std::size_t lane = _thread_pool.LaneOf(key);
+      std::vector<Task> &batch = conn.reactor.batches[lane];
+      if (batch.empty()) {
+        conn.reactor.batched.push_back(lane);
+      }
+      batch.emplace_back([this, task = std::forward<F>(task)]() mutable {
+        if (_handlers.empty()) {
+          task(*_shared_handler);
+        } else {
+          task(*_handlers[ThreadPool::CurrentWorker()]);
+        }
+        FinishUpdate();
+      });
+      return;
+    }
+
+    if (_handlers.empty()) {
+      _thread_pool.Post(key, [this, task = std::forward<F>(task)]() mutable {
+        task(*_shared_handler);
+        FinishUpdate();
+      });
+    } else {
+      _thread_pool.Post(key, [this, task = std::forward<F>(task)]() mutable {
+        task(*_handlers[ThreadPool::CurrentWorker()]);
+        FinishUpdate();
+      });
+    }
+  }
+
+  /**
+   * @brief Posts the updates a reactor batched, each batch as a single task
+   * on its lane, and stops batching.
+   * @param reactor The reactor.
+   */
+  void PostBatches(Reactor &reactor) {
+    reactor.batching = false;
+    for (const std::size_t lane : reactor.batched) {
+      std::vector<Task> &batch = reactor.batches[lane];
+      if (batch.size() == 1) {
+        _thread_pool.Post(lane, std::move(batch.front()));
+      } else {
+        _thread_pool.Post(lane, [batch = std::move(batch)]() mutable {
+          for (Task &task : batch) {
+            task();
+          }
+        });
+      }
+      batch.clear();
+    }
+    reactor.batched.clear();
+  }
+
+  /**
+   * @brief Counts a task of the thread pool as done, waking the reactors up
+   * if it was the last one while stopping.
+   */
+  void FinishUpdate() noexcept {
+    if (_in_flight.fetch_sub(1, std::memory_order_acq_rel) == 1 && _stopping.load(std::memory_order_acquire)) {
+      WakeReactors();
     }
+  }
+
+  /**
+   * @brief Returns whether connection updates run on the thread dispatching
+   * them rather than on the thread pool.
+   * @return Whether updates run inline.
+   */
+  [[nodiscard]] bool IsInline() const noexcept { return kInline || _options.reactor_per_thread; }
+
+  /**
+   * @brief Returns the metrics of the calling thread, which is either a
+   * worker of the thread pool or the reactor of the connection at hand.
+   * @param reactor The reactor of the connection.
+   * @return The metrics.
+   */
+  [[nodiscard]] ThreadMetrics &LocalMetrics(Reactor &reactor) noexcept {
+    const std::size_t worker = ThreadPool::CurrentWorker();
+    return worker == ThreadPool::npos ? reactor.metrics : _worker_metrics[worker];
+  }
+
+  /**
+   * @brief Converts a duration to nanoseconds for the histograms.
+   * @param duration The duration.
+   * @return The nanoseconds, zero for negative durations.
+   */
+  [[nodiscard]] static std::uint64_t Nanoseconds(const Clock::duration duration) noexcept {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return ns > 0 ? static_cast<std::uint64_t>(ns) : 0;
+  }
 
-    // Add the server socket to the epoll instance
-    epoll_event server_event = {.events = EPOLLIN, .data = {.fd = _server_fd}};
-    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _server_fd, &server_event) == -1) {
-      throw Error("Failed to add server socket to epoll instance.", Error::Kind::EpollAdd);
+  /**
+   * @brief Records how long an update waited in the thread pool, if it went
+   * through it.
+   * @param conn The connection.
+   * @param now When the update started.
+   */
+  void NoteStarted(ConnectionState &conn, const Clock::time_point now) noexcept {
+    if (!IsInline()) {
+      const Clock::time_point dispatched{Clock::duration{conn.dispatched_at.load(std::memory_order_relaxed)}};
+      LocalMetrics(conn.reactor).queue_wait.Record(Nanoseconds(now - dispatched));
     }
+  }
 
+  /**
+   * @brief Runs the event loop of a reactor until the server is stopped and
+   * the reactor's connections are gone.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   */
+  void RunReactor(Reactor &reactor, Handler &handler) {
     // Set up an array to hold the events that are triggered
     std::vector<epoll_event> events(_max_events);
+    const auto max_events = std::max(static_cast<std::size_t>(_max_events), _options.max_events_limit);
+
+    // Set up a batch per lane of the thread pool
+    if (_options.batch_dispatch && !IsInline()) {
+      reactor.batches.resize(_thread_pool.Lanes());
+    }
 
     // Event Loop
     while (true) {
-      // Wait for events on the sockets in the epoll instance
-      const int num_events = epoll_wait(_epoll_fd, events.data(), _max_events, -1);
+      // Wait for events on the sockets in the epoll instance, or for the
+      // next timer
+      const int num_events =
+          epoll_wait(reactor.epoll_fd, events.data(), static_cast<int>(events.size()), NextTimeout(reactor));
+      reactor.now = Clock::now();
+
+      // Forget the connections closed in the meantime, their events are
+      // stale
+      ReapClosed(reactor);
 
       // Check if there was an error while waiting for events
       if (num_events == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
         throw Error("Failed to wait for events.", Error::Kind::EpollWait);
       }
 
+      // Batch what is dispatched until the events are handled
+      reactor.batching = !reactor.batches.empty();
+
       // Process each event
       for (int i = 0; i < num_events; ++i) {
-        // Check if the event was triggered by our own close() call
-        if (events[i].events & EPOLLHUP) {
+        const std::uint64_t key = events[i].data.u64;
+        if (const int server_fd = FindListener(reactor, key); server_fd != -1) {
+          // New connections
+          AcceptConnections(reactor, handler, server_fd);
+          continue;
+        } else if (key == Table::Key(reactor.event_fd, 0)) {
+          // Woken up, what for is picked up below
+          eventfd_t value{};
+          eventfd_read(reactor.event_fd, &value);
+          continue;
+        } else if (key == Table::Key(_handoff_fd, 0)) {
+          // A newer process restarting the server
+          AcceptSuccessor(reactor);
+          continue;
+        } else if (key == Table::Key(_successor_fd, 0)) {
+          FinishHandoff();
+          continue;
+        }
+
+        // Event on existing connection, which may have been closed and its
+        // descriptor given to a new one since the wait returned
+        const ConnPtr *found = reactor.conns.Find(key);
+        if (found == nullptr) {
+          continue;
+        }
+        const ConnPtr conn = *found;
+
+#ifdef TCP_TLS
+        // Connections still shaking hands are not the handler's yet
+        if (conn->tls) {
+          ContinueHandshake(handler, conn);
           continue;
         }
+#endif
 
-        if (events[i].data.fd == _server_fd) {
-          // New connection
+        // Zero-copy completions raise EPOLLERR until they are taken
+        if (_options.zerocopy_threshold > 0 && (events[i].events & EPOLLERR)) {
+          WriteQueue::ReapZerocopy(conn->fd);
+        }
 
-          // Accept the connection
-          sockaddr_in client_addr{};
-          socklen_t client_addr_len = sizeof(client_addr);
-          const int client_fd = accept(_server_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len);
+        // Hang ups and errors are reported through the read
+        const bool readable = (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
 
-          // Check if the connection was accepted successfully
-          if (client_fd == -1) {
-            continue;  // Ignore the connection
-          }
+        // Finish pending writes first, it may resume reading
+        if ((events[i].events & EPOLLOUT) && !FlushConnection(handler, conn)) {
+          continue;
+        }
 
-          // Add the server socket to the epoll instance
-          epoll_event client_event = {.events = EPOLLIN, .data = {.fd = client_fd}};
-          if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1) {
-            close(client_fd);
-            continue;  // Ignore the connection
-          }
+        // Hold back or turn away updates over the limits, before reading.
+        // Hang ups and errors cannot be waited out, they are read right away
+        if (readable && HasLimits() && (events[i].events & (EPOLLHUP | EPOLLERR)) == 0 &&
+            !Admit(reactor, handler, conn)) {
+          continue;
+        }
 
-          // Push the task to the thread pool
-          _thread_pool.Push([&handler, client_fd] { HandleConnUpdate<UpdateKind::New>(handler, client_fd); });
-        } else {
-          // Event on existing connection
-
-          // Get the client socket
-          const int client_fd = events[i].data.fd;
-
-          // Read the message
-          std::vector<std::byte> in_buf(_buf_size);
-          const ssize_t n = read(client_fd, in_buf.data(), in_buf.size());
-
-          // Check if there was an error, or if the client closed the connection
-          if (n == -1) {
-            // Get the client address
-            sockaddr_in client_addr{};
-            try {
-              client_addr = GetClientAddress(client_fd);
-            }
-            catch (const Error &e) {
-                // Ignore the error
-            }
-
-
-            // Close the connection
-            close(client_fd);
-
-            // Push the task to the thread pool
-            _thread_pool.Push([&handler, client_addr] { handler.OnError(client_addr, {"Failed to read from a client.", Error::Kind::Read}); });
-          } else if (n == 0) {
-            // Get the client address
-            sockaddr_in client_addr{};
-            try {
-              client_addr = GetClientAddress(client_fd);
-            }
-            catch (const Error &e) {
-                    // Ignore the error
-            }
-
-            // Close the connection
-            close(client_fd);
-
-            // Push the task to the thread pool
-            _thread_pool.Push( [&handler, client_addr] { handler.OnClose(client_addr); });
+        if (_options.edge_triggered) {
+          // Edge triggered sockets are drained in one go, the socket stays
+          // disarmed until the handler is done with it
+          if (readable && !IsReadPaused(conn)) {
+            DrainConnection(handler, conn);
           } else {
-            // Push the task to the thread pool
-            _thread_pool.Push([&handler, client_fd, in_buf = std::move(in_buf)] { HandleConnUpdate<UpdateKind::Read>(handler, client_fd, in_buf); });
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            ArmLocked(handler, conn, EPOLL_CTL_MOD);
           }
+        } else if (readable) {
+          ReadConnection(handler, conn);
         }
       }
+
+      // Close the connections that timed out
+      if (_min_timeout > std::chrono::milliseconds::zero()) {
+        ExpireTimeouts(reactor, handler);
+      }
+
+      // Read again from the connections whose updates fit the limits again
+      if (!reactor.throttled.empty()) {
+        ResumeThrottled(reactor, handler);
+      }
+
+      // Resume the coroutines whose wait is over
+      if constexpr (kAsync) {
+        ResumeWoken(reactor, handler);
+      }
+
+      // Hand the batches over
+      if (reactor.batching) {
+        PostBatches(reactor);
+      }
+
+      // Wait for more events at once if the wait came back full
+      if (static_cast<std::size_t>(num_events) == events.size() && events.size() < max_events) {
+        events.resize(std::min(events.size() * 2, max_events));
+      }
+
+      // Shut down once stopped, until every connection is gone
+      if (_stopping.load(std::memory_order_acquire) && Drain(reactor, handler)) {
+        return;
+      }
     }
   }
 
- private:
   /**
-   * @brief Handles a connection update.
-   * @tparam UK The update kind.
+   * @brief Moves a reactor's shutdown forward: stops accepting and reading
+   * first, then closes the connections once the queued work is done, idle
+   * ones right away and the others once their responses drained or the
+   * drain timeout expired.
+   * @param reactor The reactor.
    * @param handler The handler for the server.
-   * @param client_fd The client socket.
-   * @param in_buf The input buffer.
+   * @return Whether the reactor is done, with no connection left.
    */
-  template <UpdateKind UK>
-  static void HandleConnUpdate(Handler handler, const int client_fd, const std::vector<std::byte> &in_buf = {}) noexcept {
-    // Get the client address
-    sockaddr_in client_addr{};
-    try {
-      client_addr = GetClientAddress(client_fd);
-    } catch (const Error &error) {
-      close(client_fd);
-      return handler.OnError(client_addr, error);
+  bool Drain(Reactor &reactor, Handler &handler) {
+    // Stop accepting and reading once
+    if (!reactor.draining) {
+      reactor.draining = true;
+      reactor.drain_deadline = reactor.now + _options.drain_timeout;
+      StopListening(reactor);
+      reactor.conns.ForEach([this, &handler](const ConnPtr &conn) {
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        if (!conn->closed) {
+          conn->read_paused = true;
+          conn->stopping = true;
+          UpdateInterestLocked(handler, conn, lock);
+        }
+      });
     }
 
-    // Set up the buffer for the write operation
-    std::vector<std::byte> out_buf;
+    // Wait for the updates in flight, they may queue responses
+    const bool idle = _in_flight.load(std::memory_order_acquire) == 0;
+    const bool expired = reactor.now >= reactor.drain_deadline;
+    if (idle || expired) {
+      reactor.conns.ForEach([this, &handler, expired](const ConnPtr &conn) {
+        std::unique_lock<std::mutex> lock(conn->mutex);
+        if (conn->closed || (!expired && IsAsyncBusyLocked(*conn))) {
+          return;  // Done with already, or a coroutine still at work
+        } else if (!expired && !conn->out.empty()) {
+          conn->closing = true;  // Closed and reported once drained
+          return;
+        }
+        CloseLocked(conn);
+        lock.unlock();
+        DispatchClose(handler, conn);
+      });
+    }
 
-    // Call the Handler
-    bool keep_alive{};
+    // Done once the connections are forgotten, and nothing is left to run
+    if (reactor.conns.Size() > 0 || _in_flight.load(std::memory_order_acquire) > 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(reactor.mutex);
+    return reactor.wakes.empty() && !reactor.closed;
+  }
 
-    // Constexpr if on what kind of update to call the proper method
-    if constexpr (UK == UpdateKind::New) {
-      keep_alive = handler.OnNew(client_addr, out_buf);
-    } else if constexpr (UK == UpdateKind::Read) {
-      keep_alive = handler.OnRead(client_addr, in_buf, out_buf);
+  /**
+   * @brief Returns the listening socket of a reactor an event is about.
+   * @param reactor The reactor.
+   * @param key The key of the event.
+   * @return The listening socket, -1 if the event is about something else.
+   */
+  [[nodiscard]] static int FindListener(const Reactor &reactor, const std::uint64_t key) noexcept {
+    for (const int server_fd : reactor.server_fds) {
+      if (key == Table::Key(server_fd, 0)) {
+        return server_fd;
+      }
+    }
+    return -1;
+  }
+
+  /**
+   * @brief Closes a reactor's listening sockets, and the hand-off socket and
+   * Unix domain socket files along with the first one. The socket files are
+   * left to the newer process the sockets were handed to, if any.
+   * @param reactor The reactor.
+   */
+  void StopListening(Reactor &reactor) noexcept {
+    {
+      std::lock_guard<std::mutex> lock(_listen_mutex);
+      for (const int server_fd : reactor.server_fds) {
+        close(server_fd);
+      }
+      reactor.server_fds.clear();
+    }
+    if (&reactor != &_reactors.front()) {
+      return;
+    }
+    if (_handoff_fd != -1) {
+      close(std::exchange(_handoff_fd, -1));
+      if (!_handed_off) {
+        unlink(_options.handoff_path.c_str());
+      }
+    }
+    for (const Address &addr : _listeners) {
+      if (const std::string path = addr.Path(); !_handed_off && !path.empty() && path.front() != '@') {
+        unlink(path.c_str());
+      }
+    }
+  }
+
+  /**
+   * @brief Returns how long a reactor may wait for events before its next
+   * timer expires, and records until when it sleeps.
+   * @param reactor The reactor.
+   * @return The timeout in milliseconds, -1 if there is no timer.
+   */
+  [[nodiscard]] int NextTimeout(Reactor &reactor) const noexcept {
+    // The timing wheel only changes on the reactor
+    const std::uint64_t tick = reactor.wheel.NextExpiry();
+    Clock::time_point deadline = tick == TimerWheel::kNever ? Clock::time_point::max() : TimeOf(tick);
+    if (reactor.draining) {
+      deadline = std::min(deadline, reactor.drain_deadline);
+    }
+    if (!reactor.throttled.empty()) {
+      deadline = std::min(deadline, reactor.now + _options.timer_tick);
+    }
+
+    std::lock_guard<std::mutex> lock(reactor.mutex);
+
+    // Check if there is anything to resume or reap right away
+    if (!reactor.wakes.empty() || reactor.closed) {
+      return 0;
+    } else if (!reactor.timers.empty()) {
+      deadline = std::min(deadline, reactor.timers.top().deadline);
+    }
+    reactor.sleeping_until = deadline;
+    if (deadline == Clock::time_point::max()) {
+      return -1;
+    }
+
+    // Round up, so the timer is due once the wait returns
+    const auto delay = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+    return static_cast<int>(std::clamp<std::chrono::milliseconds::rep>(delay.count(), 0, INT_MAX));
+  }
+
+  /**
+   * @brief Wakes a reactor up if it sleeps past a deadline.
+   * @param reactor The reactor, locked by the caller.
+   * @param deadline The deadline.
+   */
+  static void WakeReactorLocked(Reactor &reactor, const Clock::time_point deadline) noexcept {
+    if (deadline < reactor.sleeping_until) {
+      reactor.sleeping_until = Clock::time_point::min();
+      eventfd_write(reactor.event_fd, 1);
+    }
+  }
+
+  /**
+   * @brief Wakes up the coroutines whose timers expired, then hands every
+   * coroutine whose wait is over to the thread pool.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   */
+  void ResumeWoken(Reactor &reactor, Handler &handler) {
+    // Take the expired timers
+    std::vector<Timer> expired;
+    {
+      std::lock_guard<std::mutex> lock(reactor.mutex);
+      while (!reactor.timers.empty() && reactor.timers.top().deadline <= reactor.now) {
+        expired.push_back(reactor.timers.top());
+        reactor.timers.pop();
+      }
+    }
+
+    // End the waits on them, unless they were ended already
+    for (const Timer &timer : expired) {
+      std::lock_guard<std::mutex> lock(timer.conn->mutex);
+      WakeLocked(timer.conn, Wait::Sleep, timer.wait_id);
+    }
+
+    // Resume the coroutines
+    std::vector<Wake> wakes;
+    {
+      std::lock_guard<std::mutex> lock(reactor.mutex);
+      wakes.swap(reactor.wakes);
+    }
+    for (Wake &wake : wakes) {
+      ConnectionState &state = *wake.conn;
+      Dispatch(handler, state, [this, conn = std::move(wake.conn), handle = wake.handle](Handler &local) {
+        RunAsync(local, conn, handle);
+      });
+    }
+  }
+
+  /**
+   * @brief Forgets the connections closed since the reactor last woke up,
+   * and closes their sockets.
+   * @param reactor The reactor.
+   */
+  static void ReapClosed(Reactor &reactor) noexcept {
+    // Producers no longer need to wake the reactor
+    ConnPtr closed;
+    {
+      std::lock_guard<std::mutex> lock(reactor.mutex);
+      reactor.sleeping_until = Clock::time_point::min();
+      closed = std::move(reactor.closed);
+    }
+
+    // Unlink them from the table and the wheel before their descriptors can
+    // be reused
+    while (closed) {
+      reactor.metrics.closes.Add();
+      reactor.conns.Erase(closed->key);
+      reactor.wheel.Cancel(*closed);
+      close(closed->fd);
+      closed = std::move(closed->next_closed);
+    }
+  }
+
+  /**
+   * @brief Checks the connections whose timer expired.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   */
+  void ExpireTimeouts(Reactor &reactor, Handler &handler) {
+    reactor.wheel.Advance(TickOf(reactor.now), [this, &reactor, &handler](TimerWheel::Node &node) {
+      CheckTimeouts(reactor, handler, static_cast<ConnectionState &>(node));
+    });
+  }
+
+  /**
+   * @brief Closes a connection past one of its deadlines, or moves its timer
+   * to the next one.
+   * @param reactor The reactor serving the connection.
+   * @param handler The handler for the server.
+   * @param state The connection, open unless it is about to be forgotten.
+   */
+  void CheckTimeouts(Reactor &reactor, Handler &handler, ConnectionState &state) {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    if (state.closed) {
+      return;
+    }
+
+    // Find the earliest deadline of the limits that apply right now
+    Clock::time_point deadline = Clock::time_point::max();
+    Timeout kind = Timeout::Idle;
+    const auto watch = [&deadline, &kind](const bool applies, const Clock::time_point since,
+                                          const std::chrono::milliseconds timeout, const Timeout which) {
+      if (applies && timeout > std::chrono::milliseconds::zero() && since + timeout < deadline) {
+        deadline = since + timeout;
+        kind = which;
+      }
+    };
+    watch(!IsAsyncBusyLocked(state), std::max(state.last_read, state.last_write), _options.idle_timeout, Timeout::Idle);
+    watch(static_cast<bool>(state.partial), state.partial_since, _options.read_timeout, Timeout::Read);
+    watch(!state.out.empty(), state.last_write, _options.write_timeout, Timeout::Write);
+
+    // Check again by the deadline, or within the shortest timeout since a
+    // limit may start applying in the meantime
+    if (deadline > reactor.now) {
+      reactor.wheel.Schedule(state, TickAfter(std::min(deadline, reactor.now + _min_timeout)));
+      return;
+    }
+
+    // Close the connection, then report it like any other update
+    const ConnPtr conn = state.shared_from_this();
+    CloseLocked(conn);
+    lock.unlock();
+    reactor.metrics.timeouts.Add();
+    if constexpr (TimeoutHandler<Handler>) {
+      if (!Handshaking(state)) {
+        Dispatch(handler, state, [conn, kind](Handler &local) { local.OnTimeout(*conn, kind); });
+      }
+    } else {
+      DispatchClose(handler, conn);
+    }
+  }
+
+  /**
+   * @brief Returns whether a coroutine is busy with a connection.
+   * @param state The connection, locked by the caller.
+   * @return Whether a coroutine is busy with it.
+   */
+  [[nodiscard]] static bool IsAsyncBusyLocked([[maybe_unused]] const ConnectionState &state) noexcept {
+    if constexpr (kAsync) {
+      return state.async.busy;
+    }
+    return false;
+  }
+
+  /**
+   * @brief Returns the tick of the timing wheels a time point falls in.
+   * @param time The time point.
+   * @return The tick.
+   */
+  [[nodiscard]] std::uint64_t TickOf(const Clock::time_point time) const noexcept {
+    return time <= _epoch ? 0 : static_cast<std::uint64_t>((time - _epoch) / _options.timer_tick);
+  }
+
+  /**
+   * @brief Returns the first tick of the timing wheels that starts at or
+   * after a time point.
+   * @param time The time point.
+   * @return The tick.
+   */
+  [[nodiscard]] std::uint64_t TickAfter(const Clock::time_point time) const noexcept {
+    const std::uint64_t tick = TickOf(time);
+    return TimeOf(tick) < time ? tick + 1 : tick;
+  }
+
+  /**
+   * @brief Returns when a tick of the timing wheels starts.
+   * @param tick The tick.
+   * @return The time point.
+   */
+  [[nodiscard]] Clock::time_point TimeOf(const std::uint64_t tick) const noexcept {
+    return _epoch + std::chrono::duration_cast<Clock::duration>(_options.timer_tick) * static_cast<Clock::rep>(tick);
+  }
+
+  /**
+   * @brief Accepts pending connections until the backlog is empty or the per
+   * wake up limit is reached. Connections left in the backlog are reported
+   * again by the next wait.
+   * @param reactor The reactor whose listening socket is ready.
+   * @param handler The handler for the server.
+   * @param server_fd The listening socket.
+   */
+  void AcceptConnections(Reactor &reactor, Handler &handler, const int server_fd) {
+    for (std::size_t accepted = 0; accepted < _options.max_accepts_per_wakeup;) {
+      // Accept the connection, already non-blocking and closed on exec
+      sockaddr_storage client_addr{};
+      socklen_t client_addr_len = sizeof(client_addr);
+      const int client_fd = accept4(server_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len,
+                                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      // Check if the connection was accepted successfully
+      if (client_fd == -1) {
+        if (errno == EINTR || errno == ECONNABORTED) {
+          continue;  // Try the next one
+        }
+        return;  // Backlog empty, or out of descriptors
+      }
+      ++accepted;
+      reactor.metrics.accepts.Add();
+
+      // Let large slices be sent without copying them, best effort
+      if (_options.zerocopy_threshold > 0 && client_addr.ss_family != AF_UNIX) {
+        const int one = 1;
+        setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+      }
+
+      // Keep track of the connection, and of the address accept reported
+      const Address addr(reinterpret_cast<const sockaddr *>(&client_addr), client_addr_len);
+      auto conn = std::make_shared<ConnectionState>(client_fd, addr, reactor, *this);
+      conn->key = reactor.conns.Insert(client_fd, conn);
+      if (_options.client_rate > 0) {
+        conn->bucket = TokenBucket(_options.client_rate, _options.client_burst, reactor.now);
+      }
+
+      // Start the timeouts, the connection is checked within the shortest
+      if (_min_timeout > std::chrono::milliseconds::zero()) {
+        conn->last_read = reactor.now;
+        conn->last_write = reactor.now;
+        reactor.wheel.Schedule(*conn, TickAfter(reactor.now + _min_timeout));
+      }
+
+#ifdef TCP_TLS
+      // Welcome TLS connections once their handshake is done
+      if (_tls && addr.Family() != AF_UNIX) {
+        StartHandshake(handler, conn);
+        continue;
+      }
+#endif
+
+      Welcome(handler, std::move(conn), EPOLL_CTL_ADD);
+    }
+  }
+
+  /**
+   * @brief Starts serving a new connection: registers its socket and lets
+   * the handler welcome it, or turns it away while overloaded.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param op EPOLL_CTL_ADD for sockets not registered yet, EPOLL_CTL_MOD
+   * for sockets registered for their TLS handshake.
+   */
+  void Welcome(Handler &handler, ConnPtr conn, const int op) {
+    // Turn the connection away instead of welcoming it while overloaded
+    Reactor &reactor = conn->reactor;
+    [[maybe_unused]] ConnectionState &state = *conn;
+    const bool rejected = _options.overload == Overload::RejectNew && HasLimits() && Overloaded(reactor);
+
+    if (_options.edge_triggered) {
+      // Edge triggered sockets are only armed once OnNew is done, so it
+      // cannot race with the first read
+      if (rejected) {
+        Reject(handler, conn);
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        ArmLocked(handler, conn, op);
+      } else if constexpr (NewHandler<Handler>) {
+        Dispatch(handler, state, [this, conn = std::move(conn), op](Handler &local) {
+          if (HandleNew(local, conn)) {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            ArmLocked(local, conn, op);
+          }
+        });
+      } else {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        ArmLocked(handler, conn, op);
+      }
+      return;
+    }
+
+    // Add the client socket to the epoll instance
+    epoll_event client_event = {.events = EPOLLIN, .data = {.u64 = conn->key}};
+    if (epoll_ctl(reactor.epoll_fd, op, conn->fd, &client_event) == -1) {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      CloseLocked(conn);
+      return;  // Ignore the connection
+    }
+    conn->events = EPOLLIN;
+
+    // Handle the new connection, if the handler wants to know
+    if (rejected) {
+      Reject(handler, conn);
+    } else if constexpr (NewHandler<Handler>) {
+      Dispatch(handler, state, [this, conn = std::move(conn)](Handler &local) { HandleNew(local, conn); });
+    }
+  }
+
+#ifdef TCP_TLS
+  /**
+   * @brief Starts the TLS handshake of a new connection. The socket is level
+   * triggered until the handshake is done, whatever the mode.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void StartHandshake(Handler &handler, const ConnPtr &conn) {
+    conn->tls = _tls->NewSession(conn->fd);
+    epoll_event client_event = {.events = EPOLLIN, .data = {.u64 = conn->key}};
+    if (!conn->tls || epoll_ctl(conn->reactor.epoll_fd, EPOLL_CTL_ADD, conn->fd, &client_event) == -1) {
+      return FailHandshake(conn);
+    }
+    conn->events = EPOLLIN;
+    ContinueHandshake(handler, conn);
+  }
+
+  /**
+   * @brief Moves the TLS handshake of a connection forward on the reactor,
+   * and welcomes the connection once the kernel took the session over.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void ContinueHandshake(Handler &handler, const ConnPtr &conn) {
+    const Handshake step = TlsContext::Step(conn->tls.get());
+    if (step == Handshake::Done) {
+      conn->tls.reset();
+      return Welcome(handler, conn, EPOLL_CTL_MOD);
+    } else if (step == Handshake::Failed) {
+      return FailHandshake(conn);
+    }
+
+    // Wait for the socket to let the handshake go on
+    const std::uint32_t events = step == Handshake::WantRead ? EPOLLIN : EPOLLOUT;
+    if (events != conn->events) {
+      epoll_event client_event = {.events = events, .data = {.u64 = conn->key}};
+      if (epoll_ctl(conn->reactor.epoll_fd, EPOLL_CTL_MOD, conn->fd, &client_event) == -1) {
+        return FailHandshake(conn);
+      }
+      conn->events = events;
+    }
+  }
+
+  /**
+   * @brief Closes a connection whose handshake failed. The handler never
+   * heard of it, so it is only counted.
+   * @param conn The connection.
+   */
+  void FailHandshake(const ConnPtr &conn) noexcept {
+    conn->reactor.metrics.errors.Add();
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    CloseLocked(conn);
+  }
+#endif
+
+  /**
+   * @brief Returns whether a connection is still shaking hands, so the
+   * handler never heard of it.
+   * @param conn The connection.
+   * @return Whether its TLS handshake runs.
+   */
+  [[nodiscard]] static bool Handshaking([[maybe_unused]] const ConnectionState &conn) noexcept {
+#ifdef TCP_TLS
+    return static_cast<bool>(conn.tls);
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Returns whether a read failed on a TLS record that is not data,
+   * which kernel TLS reports as EIO. Clients end their sessions with a
+   * close_notify alert, so the read is taken as the client closing.
+   * @return Whether the last read hit such a record.
+   */
+  [[nodiscard]] bool ReadHitTlsRecord() const noexcept {
+#ifdef TCP_TLS
+    return _tls && errno == EIO;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * @brief Returns whether any rate limit or bound on pending updates is
+   * set.
+   * @return Whether updates are checked before they are read.
+   */
+  [[nodiscard]] bool HasLimits() const noexcept {
+    return _options.client_rate > 0 || _options.server_rate > 0 || _options.max_pending_updates > 0;
+  }
+
+  /**
+   * @brief Returns whether the server as a whole is over its limits, the
+   * reactor's share of the rate or the bound on pending updates.
+   * @param reactor The reactor.
+   * @return Whether the server is overloaded.
+   */
+  [[nodiscard]] bool Overloaded(Reactor &reactor) noexcept {
+    return !reactor.bucket.Ready(reactor.now) ||
+           (_options.max_pending_updates > 0 &&
+            _in_flight.load(std::memory_order_relaxed) >= _options.max_pending_updates);
+  }
+
+  /**
+   * @brief Checks the next update of a connection against the limits, on
+   * the reactor before anything is read. An update that fits takes a token
+   * from both buckets, one that does not gets the overload policy.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @return Whether the update may be read and dispatched.
+   */
+  bool Admit(Reactor &reactor, Handler &handler, const ConnPtr &conn) {
+    if (conn->bucket.Ready(reactor.now) && !Overloaded(reactor)) {
+      conn->bucket.Take();
+      reactor.bucket.Take();
+      return true;
+    }
+    if (_options.overload == Overload::Shed) {
+      Reject(handler, conn);
+      if (_options.edge_triggered) {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        ArmLocked(handler, conn, EPOLL_CTL_MOD);
+      }
+    } else {
+      Throttle(reactor, handler, conn);
+    }
+    return false;
+  }
+
+  /**
+   * @brief Rejects a connection on the reactor, letting the handler write a
+   * reply, then closes it once the reply is out.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void Reject(Handler &handler, const ConnPtr &conn) {
+    conn->reactor.metrics.rejects.Add();
+    {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      conn->closing = true;
+      conn->read_paused = true;
+    }
+    Output out(conn->reactor.send_buffers);
+    if constexpr (RejectHandler<Handler>) {
+      handler.OnReject(*conn, out);
+    }
+    SendConnection(handler, conn, out);
+  }
+
+  /**
+   * @brief Stops reading from a connection until its updates fit the limits
+   * again, leaving the client to TCP flow control.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void Throttle(Reactor &reactor, Handler &handler, const ConnPtr &conn) {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->closed || conn->throttled) {
+      return;
+    }
+    conn->throttled = true;
+    reactor.metrics.throttles.Add();
+    reactor.throttled.push_back(conn);
+    if (_options.edge_triggered) {
+      ArmLocked(handler, conn, EPOLL_CTL_MOD);
+    } else {
+      UpdateInterestLocked(handler, conn, lock);
+    }
+  }
+
+  /**
+   * @brief Reads again from the throttled connections whose updates fit the
+   * limits again, and forgets the closed ones.
+   * @param reactor The reactor.
+   * @param handler The handler for the server.
+   */
+  void ResumeThrottled(Reactor &reactor, Handler &handler) {
+    std::erase_if(reactor.throttled, [this, &reactor, &handler](const ConnPtr &conn) {
+      if (!conn->bucket.Ready(reactor.now) || Overloaded(reactor)) {
+        return false;
+      }
+      std::unique_lock<std::mutex> lock(conn->mutex);
+      conn->throttled = false;
+      if (conn->closed) {
+        return true;
+      } else if (_options.edge_triggered) {
+        ArmLocked(handler, conn, EPOLL_CTL_MOD);
+      } else {
+        UpdateInterestLocked(handler, conn, lock);
+      }
+      return true;
+    });
+  }
+
+  /**
+   * @brief Reads the next message from a level triggered socket, and hands
+   * it to the handler.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void ReadConnection(Handler &handler, const ConnPtr &conn) {
+    // Read the message into a recycled buffer, behind the start of a frame
+    // received earlier if any
+    std::size_t len = 0;
+    BufferPool::Buffer in_buf = TakeReceiveBuffer(conn, len);
+    const ssize_t n = read(conn->fd, in_buf->data() + len, in_buf->size() - len);
+
+    // Check if the wake up was spurious
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return KeepPartialFrame(conn, std::move(in_buf), len);
+    }
+
+    // Check if there was an error, or if the client closed the connection
+    if (n == -1 && !ReadHitTlsRecord()) {
+      return FailConnectionLater(handler, conn, {"Failed to read from a client.", Error::Kind::Read});
+    } else if (n <= 0) {
+      // Close right away, the socket would keep reporting the hang up
+      if (CloseForReport(conn)) {
+        DispatchClose(handler, conn);
+      }
+      return;
+    }
+
+    // Split off the complete frames, there may be none yet
+    conn->reactor.metrics.reads.Add();
+    conn->reactor.metrics.bytes_read.Add(static_cast<std::size_t>(n));
+    const std::size_t complete = SplitFrames(conn, in_buf, len + static_cast<std::size_t>(n));
+    NoteReceived(conn, len, complete);
+    if (complete == kInvalidFrame) {
+      return FailConnectionLater(handler, conn, {"Received a malformed frame.", Error::Kind::Read});
+    } else if (complete == 0) {
+      return;
     }
 
-    // Write the response to the client
+    // Handle the message
+    if constexpr (kAsync) {
+      DeliverInput(handler, conn, std::move(in_buf), complete, false);
+    } else {
+      TerminateMessage(*in_buf, complete);
+      Dispatch(handler, *conn, [this, conn, complete, in_buf = std::move(in_buf)](Handler &local) {
+        HandleConnUpdate<UpdateKind::Read>(local, conn, *in_buf, complete);
+      });
+    }
+  }
+
+  /**
+   * @brief Reads from an edge triggered socket until it runs dry, and hands
+   * everything that was read to the handler at once. The socket stays
+   * disarmed until the handler is done with it.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void DrainConnection(Handler &handler, const ConnPtr &conn) {
+    // Read into a recycled buffer, behind the start of a frame received
+    // earlier if any, growing it while the socket has more
+    std::size_t pending = 0;
+    BufferPool::Buffer in_buf = TakeReceiveBuffer(conn, pending);
+    std::size_t len = pending;
+    bool eof = false;
+    bool failed = false;
+    while (true) {
+      if (len == in_buf->size()) {
+        if (len - pending >= kMaxDrainChunks * _buf_size) {
+          break;  // Re-arming reports whatever is left
+        }
+        in_buf->resize(in_buf->size() + _buf_size);
+      }
+
+      const ssize_t n = read(conn->fd, in_buf->data() + len, in_buf->size() - len);
+      if (n > 0) {
+        len += static_cast<std::size_t>(n);
+      } else if (n == 0 || ReadHitTlsRecord()) {
+        eof = true;
+        break;
+      } else if (errno != EINTR) {
+        failed = errno != EAGAIN && errno != EWOULDBLOCK;
+        break;
+      }
+    }
+
+    // Check if there was an error
+    if (failed) {
+      return FailConnectionLater(handler, conn, {"Failed to read from a client.", Error::Kind::Read});
+    }
+
+    // Split off the complete frames, there may be none yet
+    const std::size_t complete = len == 0 ? 0 : SplitFrames(conn, in_buf, len);
+    if (len > pending) {
+      conn->reactor.metrics.reads.Add();
+      conn->reactor.metrics.bytes_read.Add(len - pending);
+      NoteReceived(conn, pending, complete);
+    }
+    if (complete == kInvalidFrame) {
+      return FailConnectionLater(handler, conn, {"Received a malformed frame.", Error::Kind::Read});
+    }
+
+    // Nothing to handle, wait for the next edge
+    if (complete == 0 && !eof) {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      return ArmLocked(handler, conn, EPOLL_CTL_MOD);
+    }
+
+    // Check if the client closed the connection without completing a frame
+    if (complete == 0) {
+      if (CloseForReport(conn)) {
+        DispatchClose(handler, conn);
+      }
+      return;
+    }
+
+    // Handle the message, then either re-arm the socket or close it
+    if constexpr (kAsync) {
+      DeliverInput(handler, conn, std::move(in_buf), complete, eof);
+    } else {
+      TerminateMessage(*in_buf, complete);
+      Dispatch(handler, *conn, [this, conn, eof, complete, in_buf = std::move(in_buf)](Handler &local) {
+        if (HandleConnUpdate<UpdateKind::Read>(local, conn, *in_buf, complete)) {
+          if (eof) {
+            CloseConnection(local, conn);
+          } else {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            ArmLocked(local, conn, EPOLL_CTL_MOD);
+          }
+        }
+      });
+    }
+  }
+
+  /**
+   * @brief Borrows a buffer to receive into, reusing the one holding the
+   * start of a frame received earlier if any.
+   * @param conn The connection.
+   * @param pending Set to the number of bytes already in the buffer.
+   * @return The buffer, with room for buf_size more bytes.
+   */
+  [[nodiscard]] BufferPool::Buffer TakeReceiveBuffer(const ConnPtr &conn, std::size_t &pending) {
+    if constexpr (kFramed) {
+      if (conn->partial) {
+        BufferPool::Buffer in_buf = std::move(conn->partial);
+        pending = in_buf->size();
+        in_buf->resize(pending + _buf_size);
+        return in_buf;
+      }
+    }
+    pending = 0;
+    return conn->reactor.recv_buffers.AcquireSized();
+  }
+
+  /**
+   * @brief Records when a connection received something, and when the frame
+   * left incomplete started. Keeps acknowledging right away if asked to.
+   * @param conn The connection.
+   * @param pending The number of bytes of a frame received earlier.
+   * @param complete The number of bytes of complete frames received.
+   */
+  void NoteReceived(const ConnPtr &conn, const std::size_t pending, const std::size_t complete) const noexcept {
+    conn->last_read = conn->reactor.now;
+    if (pending == 0 || complete > 0) {
+      conn->partial_since = conn->reactor.now;
+    }
+    if (_options.sockets.quick_ack && conn->addr.Family() != AF_UNIX) {
+      RearmQuickAck(conn->fd);
+    }
+  }
+
+  /**
+   * @brief Keeps the start of a frame until the rest of it is received.
+   * @param conn The connection.
+   * @param in_buf The buffer holding it.
+   * @param len The number of bytes of it.
+   */
+  static void KeepPartialFrame(const ConnPtr &conn, BufferPool::Buffer &&in_buf, const std::size_t len) {
+    if (len > 0) {
+      in_buf->resize(len);
+      conn->partial = std::move(in_buf);
+    }
+  }
+
+  /**
+   * @brief Finds where the complete frames received end, and keeps whatever
+   * comes after them until the rest of it is received.
+   * @param conn The connection.
+   * @param in_buf The bytes received, taken over if they hold no complete
+   * frame.
+   * @param len The number of bytes received.
+   * @return The number of bytes of complete frames, or kInvalidFrame if the
+   * stream is malformed.
+   */
+  [[nodiscard]] std::size_t SplitFrames(const ConnPtr &conn, BufferPool::Buffer &in_buf, const std::size_t len) {
+    if constexpr (!kFramed) {
+      return len;
+    }
+
+    // Walk the complete frames
+    std::span<const std::byte> rest = std::span(*in_buf).first(len);
+    std::size_t complete = 0;
+    while (!rest.empty()) {
+      const std::size_t size = Framing::FrameSize(rest);
+      if (size == kInvalidFrame) {
+        return kInvalidFrame;
+      } else if (size == kIncompleteFrame) {
+        break;
+      }
+      complete += size;
+      rest = rest.subspan(size);
+    }
+
+    // Keep the incomplete frame, copying it out only if the buffer goes to
+    // the handler
+    if (complete == 0) {
+      KeepPartialFrame(conn, std::move(in_buf), len);
+    } else if (!rest.empty()) {
+      BufferPool::Buffer partial = conn->reactor.recv_buffers.AcquireEmpty();
+      partial->assign(rest.begin(), rest.end());
+      conn->partial = std::move(partial);
+    }
+    return complete;
+  }
+
+  /**
+   * @brief Terminates a message with a null byte for handlers reading whole
+   * receive buffers, since recycled buffers are not zero-filled.
+   * @param in_buf The receive buffer.
+   * @param len The number of bytes received.
+   */
+  static void TerminateMessage([[maybe_unused]] std::vector<std::byte> &in_buf, [[maybe_unused]] const std::size_t len) noexcept {
+    if constexpr (!kSpanRead) {
+      if (len < in_buf.size()) {
+        in_buf[len] = std::byte{0};
+      }
+    }
+  }
+
+  /**
+   * @brief Queues a response behind the pending ones and writes as much as
+   * the socket takes. The rest is written by the reactor on EPOLLOUT.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param out The response.
+   * @return Whether the connection is still open.
+   */
+  bool SendConnection(Handler &handler, const ConnPtr &conn, Output &out) noexcept {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->closed) {
+      return false;
+    }
+
+    // Keep the response in order behind whatever is pending
+    const std::size_t pending = conn->out.bytes();
+    if (_options.metrics && pending == 0) {
+      conn->write_since = Clock::now();
+    }
     try {
-      // Write the response to the client
-      Write(client_fd, out_buf);
-    } catch (const Error &e) {
+      out.MoveTo(conn->out);
+    } catch (const std::bad_alloc &) {
+      lock.unlock();
+      FailConnection(handler, conn, {"Failed to queue response.", Error::Kind::Write});
+      return false;
+    }
+
+    // Write as much as the socket takes
+    const std::size_t queued = conn->out.bytes();
+    if (conn->out.Flush(conn->fd, _options.zerocopy_threshold) == WriteQueue::Status::Failed) {
+      lock.unlock();
+      FailConnection(handler, conn, {"Failed to write response.", Error::Kind::Write});
+      return false;
+    }
+    NoteWrittenLocked(conn, queued - conn->out.bytes(), pending == 0 || conn->out.bytes() < queued);
+
+    // Wait for EPOLLOUT if something is left, pausing reads past the high
+    // watermark
+    return UpdateInterestLocked(handler, conn, lock);
+  }
+
+  /**
+   * @brief Writes pending responses once the socket has room again.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @return Whether the connection is still open.
+   */
+  bool FlushConnection(Handler &handler, const ConnPtr &conn) noexcept {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->closed) {
+      return false;
+    }
+
+    // Write as much as the socket takes
+    const std::size_t pending = conn->out.bytes();
+    if (conn->out.Flush(conn->fd, _options.zerocopy_threshold) == WriteQueue::Status::Failed) {
+      lock.unlock();
+      FailConnection(handler, conn, {"Failed to write response.", Error::Kind::Write});
+      return false;
+    }
+    NoteWrittenLocked(conn, pending - conn->out.bytes(), conn->out.bytes() < pending);
+
+    // Stop waiting for EPOLLOUT once drained, resuming reads below the low
+    // watermark
+    return UpdateInterestLocked(handler, conn, lock);
+  }
+
+  /**
+   * @brief Records what the responses of a connection wrote, and when they
+   * made progress if any timeout is kept.
+   * @param conn The connection, locked by the caller.
+   * @param written The number of bytes written.
+   * @param progress Whether bytes were written, or started waiting.
+   */
+  void NoteWrittenLocked(const ConnPtr &conn, const std::size_t written, const bool progress) noexcept {
+    ThreadMetrics &metrics = LocalMetrics(conn->reactor);
+    metrics.bytes_written.Add(written);
+    if (_options.metrics && conn->out.empty() && conn->write_since != Clock::time_point{}) {
+      metrics.write_time.Record(Nanoseconds(Clock::now() - conn->write_since));
+      conn->write_since = {};
+    }
+    if (progress && _min_timeout > std::chrono::milliseconds::zero()) {
+      conn->last_write = Clock::now();
+    }
+  }
+
+  /**
+   * @brief Updates which events a connection waits for after its write
+   * queue changed. Closes the connection if it was only waiting for its
+   * responses to go out.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param lock The lock on the connection.
+   * @return Whether the connection is still open.
+   */
+  bool UpdateInterestLocked(Handler &handler, const ConnPtr &conn,
+                            std::unique_lock<std::mutex> &lock) noexcept {
+    // Check if the connection was only waiting for its responses to go out
+    if (conn->closing && conn->out.empty()) {
+      CloseLocked(conn);
+      if constexpr (CloseHandler<Handler>) {
+        if (conn->stopping) {
+          lock.unlock();
+          handler.OnClose(*conn);
+        }
+      }
+      return false;
+    }
+
+    // Stop reading from clients that do not drain their responses
+    if (conn->out.bytes() > _options.write_high_watermark) {
+      conn->read_paused = true;
+    } else if (conn->out.bytes() <= _options.write_low_watermark && !conn->closing && !conn->stopping) {
+      conn->read_paused = false;
+    }
+
+    // Let a coroutine waiting for room write again
+    if constexpr (kAsync) {
+      if (conn->out.bytes() <= _options.write_low_watermark) {
+        WakeLocked(conn, Wait::Write);
+      }
+    }
+
+    // Edge triggered sockets pick the change up when they are re-armed
+    const std::uint32_t events = InterestLocked(conn);
+    if (_options.edge_triggered || events == conn->events) {
+      return true;
+    }
+
+    epoll_event client_event = {.events = events, .data = {.u64 = conn->key}};
+    if (epoll_ctl(conn->reactor.epoll_fd, EPOLL_CTL_MOD, conn->fd, &client_event) == -1) {
+      lock.unlock();
+      FailConnection(handler, conn, {"Failed to modify client socket in epoll instance.", Error::Kind::EpollAdd});
+      return false;
+    }
+    conn->events = events;
+    return true;
+  }
+
+  /**
+   * @brief Arms an edge triggered socket for its next event.
+   * @param handler The handler for the server.
+   * @param conn The connection, locked by the caller.
+   * @param op EPOLL_CTL_ADD for new sockets, EPOLL_CTL_MOD afterwards.
+   */
+  void ArmLocked(Handler &handler, const ConnPtr &conn, const int op) noexcept {
+    if (conn->closed) {
+      return;
+    }
+
+    const std::uint32_t events = InterestLocked(conn);
+    epoll_event client_event = {.events = events | EPOLLET | EPOLLONESHOT, .data = {.u64 = conn->key}};
+    if (epoll_ctl(conn->reactor.epoll_fd, op, conn->fd, &client_event) == -1) {
       // Close the connection
-      close(client_fd);
+      CloseLocked(conn);
 
       // Call the Handler
-      return handler.OnError(client_addr, e);
+      if constexpr (ErrorHandler<Handler>) {
+        handler.OnError(*conn, {"Failed to add client socket to epoll instance.", Error::Kind::EpollAdd});
+      }
+      return;
+    }
+    conn->events = events;
+  }
+
+  /**
+   * @brief Returns the events a connection should wait for.
+   * @param conn The connection, locked by the caller.
+   * @return The events.
+   */
+  [[nodiscard]] static std::uint32_t InterestLocked(const ConnPtr &conn) noexcept {
+    std::uint32_t events = 0;
+    if (!conn->read_paused && !conn->throttled && !BusyLocked(conn)) {
+      events |= EPOLLIN;
+    }
+    if (!conn->out.empty()) {
+      events |= EPOLLOUT;
     }
+    return events;
+  }
+
+  /**
+   * @brief Returns whether a coroutine handling a connection is busy with
+   * something else than reading, so frames are left in the socket until it
+   * asks for them.
+   * @param conn The connection, locked by the caller.
+   * @return Whether the coroutine is busy.
+   */
+  [[nodiscard]] static bool BusyLocked([[maybe_unused]] const ConnPtr &conn) noexcept {
+    if constexpr (kAsync) {
+      return conn->async.busy && conn->async.wait != Wait::Read;
+    }
+    return false;
+  }
 
-    // Close the connection if the handler has requested it
+  /**
+   * @brief Returns whether reading from a connection is paused until its
+   * responses drain.
+   * @param conn The connection.
+   * @return Whether reading is paused.
+   */
+  [[nodiscard]] static bool IsReadPaused(const ConnPtr &conn) noexcept {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    return conn->read_paused;
+  }
+
+  /**
+   * @brief Closes a connection and forgets about it. Pending responses are
+   * dropped, and tasks still holding the connection see it closed.
+   * @param conn The connection, locked by the caller.
+   */
+  void CloseLocked(const ConnPtr &conn) noexcept {
+    if (conn->closed) {
+      return;
+    }
+    conn->closed = true;
+    conn->out.Clear();
+
+    // Hang up right away, but leave closing the socket to the reactor so the
+    // descriptor is not reused while it may still look the connection up
+    shutdown(conn->fd, SHUT_RDWR);
+    {
+      Reactor &reactor = conn->reactor;
+      std::lock_guard<std::mutex> lock(reactor.mutex);
+      conn->next_closed = std::exchange(reactor.closed, conn);
+      WakeReactorLocked(reactor, Clock::time_point::min());
+    }
+
+    // Let a waiting coroutine see the connection closed
+    if constexpr (kAsync) {
+      WakeLocked(conn, Wait::Any);
+    }
+  }
+
+  /**
+   * @brief Closes a connection the client closed.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   */
+  void CloseConnection([[maybe_unused]] Handler &handler, const ConnPtr &conn) noexcept {
+    if (CloseForReport(conn)) {
+      if constexpr (CloseHandler<Handler>) {
+        handler.OnClose(*conn);
+      }
+    }
+  }
+
+  /**
+   * @brief Dispatches the report of a connection that was closed, unless the
+   * handler has no OnClose, in which case nothing is dispatched at all.
+   * @param handler The handler of the calling thread.
+   * @param conn The connection.
+   */
+  void DispatchClose([[maybe_unused]] Handler &handler, [[maybe_unused]] const ConnPtr &conn) {
+    if constexpr (CloseHandler<Handler>) {
+      if (Handshaking(*conn)) {
+        return;  // Never welcomed
+      }
+      Dispatch(handler, *conn, [conn](Handler &local) { local.OnClose(*conn); });
+    }
+  }
+
+  /**
+   * @brief Closes a connection that is about to be reported to the handler.
+   * @param conn The connection.
+   * @return Whether the connection was still open, and so must be reported.
+   */
+  [[nodiscard]] bool CloseForReport(const ConnPtr &conn) noexcept {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (conn->closed) {
+      return false;
+    }
+    CloseLocked(conn);
+    return true;
+  }
+
+  /**
+   * @brief Closes a connection after an error, and reports the error on the
+   * calling thread.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param error The error.
+   */
+  void FailConnection([[maybe_unused]] Handler &handler, const ConnPtr &conn,
+                      [[maybe_unused]] const Error &error) noexcept {
+    if (CloseForReport(conn)) {
+      LocalMetrics(conn->reactor).errors.Add();
+      if constexpr (ErrorHandler<Handler>) {
+        handler.OnError(*conn, error);
+      }
+    }
+  }
+
+  /**
+   * @brief Closes a connection after an error right away, and dispatches the
+   * error report like any other update.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param error The error.
+   */
+  void FailConnectionLater([[maybe_unused]] Handler &handler, const ConnPtr &conn,
+                           [[maybe_unused]] const Error &error) {
+    if (CloseForReport(conn)) {
+      LocalMetrics(conn->reactor).errors.Add();
+      if constexpr (ErrorHandler<Handler>) {
+        Dispatch(handler, *conn, [conn, error](Handler &local) { local.OnError(*conn, error); });
+      }
+    }
+  }
+
+  /**
+   * @brief Closes a connection once its pending responses went out, reading
+   * nothing more from it in the meantime.
+   * @param conn The connection.
+   */
+  void CloseWhenDrained(const ConnPtr &conn) noexcept {
+    std::lock_guard<std::mutex> lock(conn->mutex);
+    if (conn->out.empty()) {
+      return CloseLocked(conn);
+    }
+    conn->closing = true;
+    conn->read_paused = true;
+  }
+
+  /**
+   * @brief Lets the handler welcome a new connection, without setting up an
+   * output if it never writes on open.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @return Whether the connection is still open.
+   */
+  bool HandleNew(Handler &handler, const ConnPtr &conn) noexcept {
+    if constexpr (SilentNewHandler<Handler>) {
+      if (handler.OnNew(*conn)) {
+        return true;
+      }
+      CloseWhenDrained(conn);
+      return false;
+    } else {
+      return HandleConnUpdate<UpdateKind::New>(handler, conn);
+    }
+  }
+
+  /**
+   * @brief Handles a connection update.
+   * @tparam UK The update kind.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param in_buf The input buffer.
+   * @param len The number of bytes of complete frames in the input buffer.
+   * @return Whether the connection is still open.
+   */
+  template <UpdateKind UK>
+  bool HandleConnUpdate(Handler &handler, const ConnPtr &conn, const std::vector<std::byte> &in_buf = {},
+                        [[maybe_unused]] const std::size_t len = 0) noexcept {
+    // Set up the response, its buffers go back to the pool once it is
+    // written
+    Output out(conn->reactor.send_buffers);
+    const Clock::time_point start = _options.metrics ? Clock::now() : Clock::time_point{};
+    if (_options.metrics) {
+      NoteStarted(*conn, start);
+    }
+
+    // Call the Handler
+    bool keep_alive{};
+
+    // Constexpr if on what kind of update and which flavour of callback to
+    // call the proper method
+    if constexpr (UK == UpdateKind::New && SpanNewHandler<Handler>) {
+      keep_alive = handler.OnNew(*conn, out);
+    } else if constexpr (UK == UpdateKind::New && VectorNewHandler<Handler>) {
+      keep_alive = handler.OnNew(*conn, out.Bytes());
+    } else if constexpr (UK == UpdateKind::Read && kSpanRead) {
+      // Hand over the frames one at a time, stopping once the handler closes
+      keep_alive = true;
+      for (auto rest = std::span(in_buf).first(len); keep_alive && !rest.empty();) {
+        const std::size_t size = Framing::FrameSize(rest);
+        keep_alive = handler.OnRead(*conn, Framing::Payload(rest.first(size)), out);
+        rest = rest.subspan(size);
+      }
+    } else if constexpr (UK == UpdateKind::Read) {
+      keep_alive = handler.OnRead(*conn, in_buf, out.Bytes());
+    }
+    if (_options.metrics) {
+      LocalMetrics(conn->reactor).handler_time.Record(Nanoseconds(Clock::now() - start));
+    }
+
+    // Write the response to the client, or queue it if the socket is full
+    if (!SendConnection(handler, conn, out)) {
+      return false;
+    }
+
+    // Close the connection if the handler has requested it, once the
+    // response is out
     if (!keep_alive) {
-      // Close the connection
-      close(client_fd);
+      CloseWhenDrained(conn);
     }
+    return keep_alive;
   }
 
-  // -- Member Variables --
-  /// @brief The epoll instance's file descriptor.
-  int _epoll_fd;
-  /// @brief The port to listen on.
+  /**
+   * @brief Queues the frames received for the coroutine handler, starting a
+   * coroutine on them unless one is busy with the connection already.
+   * @param handler The handler for the server.
+   * @param conn The connection.
+   * @param in_buf The receive buffer.
+   * @param len The number of bytes of complete frames in the buffer.
+   * @param eof Whether the client closed its side after them.
+   */
+  void DeliverInput(Handler &handler, const ConnPtr &conn, BufferPool::Buffer &&in_buf, const std::size_t len,
+                    const bool eof) {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    if (conn->closed) {
+      return;
+    }
+
+    AsyncState &async = conn->async;
+    async.inputs.push_back({.buf = std::move(in_buf), .len = len, .offset = 0});
+    async.eof = async.eof || eof;
+
+    // Hand the frames to the busy coroutine if it waits for them
+    if (async.busy) {
+      return WakeLocked(conn, Wait::Read);
+    }
+
+    // Start a coroutine on them
+    async.busy = true;
+    async.running = true;
+    lock.unlock();
+    Dispatch(handler, *conn, [this, conn](Handler &local) { RunAsync(local, conn, {}); });
+  }
+
+  /**
+   * @brief Runs the coroutine handling a connection until it waits, starting
+   * new ones for as long as frames are left.
+   * @param handler The handler of the calling thread.
+   * @param conn The connection.
+   * @param handle The coroutine to resume, or null to start one.
+   */
+  void RunAsync(Handler &handler, const ConnPtr &conn, std::coroutine_handle<> handle) noexcept {
+    AsyncState &async = conn->async;
+    async.handler = &handler;
+    if (_options.metrics) {
+      NoteStarted(*conn, Clock::now());
+    }
+    while (true) {
+      // Start a coroutine on the next frame, unless resuming one
+      const Clock::time_point start = _options.metrics ? Clock::now() : Clock::time_point{};
+      if (!handle) {
+        std::span<const std::byte> frame;
+        {
+          std::lock_guard<std::mutex> lock(conn->mutex);
+          frame = TakeFrameLocked(async);
+        }
+        async.task = handler.OnRead(*conn, frame, async.out, async.io);
+        handle = async.task.handle();
+      }
+      handle.resume();
+      if (_options.metrics) {
+        LocalMetrics(conn->reactor).handler_time.Record(Nanoseconds(Clock::now() - start));
+      }
+
+      // Check if the coroutine waits, it may be done waiting already
+      std::unique_lock<std::mutex> lock(conn->mutex);
+      if (!async.task.done()) {
+        if (async.ready) {
+          async.ready = false;
+          handle = std::exchange(async.handle, {});
+          continue;
+        }
+        async.running = false;
+        return ResumeReadingLocked(handler, conn, lock);
+      }
+      lock.unlock();
+
+      // Write the response to the client, closing the connection once it is
+      // out if the handler has requested it
+      const bool keep_alive = async.task.Result();
+      async.task = {};
+      handle = {};
+      if (SendConnection(handler, conn, async.out) && !keep_alive) {
+        CloseWhenDrained(conn);
+      }
 
-  std::uint16_t _port;
+      // Move on to the next frame, if any
+      lock.lock();
+      if (keep_alive && !conn->closed && HasFrameLocked(async)) {
+        continue;
+      }
+      async.busy = false;
+      async.running = false;
+      if (conn->closed) {
+        return;
+      } else if (async.eof) {
+        lock.unlock();
+        return CloseConnection(handler, conn);
+      }
+      return ResumeReadingLocked(handler, conn, lock);
+    }
+  }
+
+  /**
+   * @brief Lets the reactor read from a connection again, after its
+   * coroutine suspended or finished.
+   * @param handler The handler of the calling thread.
+   * @param conn The connection.
+   * @param lock The lock on the connection.
+   */
+  void ResumeReadingLocked(Handler &handler, const ConnPtr &conn, std::unique_lock<std::mutex> &lock) noexcept {
+    if (_options.edge_triggered) {
+      ArmLocked(handler, conn, EPOLL_CTL_MOD);
+    } else {
+      UpdateInterestLocked(handler, conn, lock);
+    }
+  }
+
+  /**
+   * @brief Ends the wait of the coroutine handling a connection, if it waits
+   * on that, and hands it to its reactor to be resumed.
+   * @param conn The connection, locked by the caller.
+   * @param kind What the wait is on.
+   * @param wait_id The wait a timer ends.
+   */
+  static void WakeLocked(const ConnPtr &conn, const Wait kind, const std::uint64_t wait_id = 0) noexcept {
+    AsyncState &async = conn->async;
+    if (async.wait == Wait::None || (kind != Wait::Any && kind != async.wait) ||
+        (kind == Wait::Sleep && wait_id != async.wait_id)) {
+      return;
+    }
+    async.wait = Wait::None;
+
+    // The thread still running the coroutine resumes it right away
+    if (async.running) {
+      async.ready = true;
+      return;
+    }
+    async.running = true;
+
+    Reactor &reactor = conn->reactor;
+    std::lock_guard<std::mutex> lock(reactor.mutex);
+    reactor.wakes.push_back({.conn = conn, .handle = std::exchange(async.handle, {})});
+    WakeReactorLocked(reactor, Clock::time_point::min());
+  }
+
+  /**
+   * @brief Returns whether a frame is left for the coroutine handler.
+   * @param async The coroutine state, locked by the caller.
+   * @return Whether a frame is left.
+   */
+  [[nodiscard]] static bool HasFrameLocked(const AsyncState &async) noexcept {
+    return std::any_of(async.inputs.begin(), async.inputs.end(),
+                       [](const Input &input) { return input.offset < input.len; });
+  }
+
+  /**
+   * @brief Takes the next frame for the coroutine handler. The buffers of the
+   * frames taken before it go back to the pool.
+   * @param async The coroutine state, locked by the caller.
+   * @return The payload of the frame, or an empty span if none is left.
+   */
+  [[nodiscard]] static std::span<const std::byte> TakeFrameLocked(AsyncState &async) noexcept {
+    while (!async.inputs.empty() && async.inputs.front().offset == async.inputs.front().len) {
+      async.inputs.pop_front();
+    }
+    if (async.inputs.empty()) {
+      return {};
+    }
+
+    // The frames are known to be complete
+    Input &input = async.inputs.front();
+    const std::span<const std::byte> rest = std::span(*input.buf).first(input.len).subspan(input.offset);
+    const std::size_t size = Framing::FrameSize(rest);
+    input.offset += size;
+    return Framing::Payload(rest.first(size));
+  }
+
+  /**
+   * @brief Suspends a coroutine until the next frame, unless one is left.
+   * @param conn The connection.
+   * @param handle The coroutine.
+   * @return Whether the coroutine was suspended.
+   */
+  static bool WaitFrame(ConnectionState &conn, const std::coroutine_handle<> handle) noexcept {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    AsyncState &async = conn.async;
+    if (conn.closed || async.eof || HasFrameLocked(async)) {
+      return false;
+    }
+    async.wait = Wait::Read;
+    async.handle = handle;
+    ++async.wait_id;
+    return true;
+  }
+
+  /**
+   * @brief Takes the frame a coroutine waited for.
+   * @param conn The connection.
+   * @return The payload of the frame, or an empty span if the connection is
+   * closed.
+   */
+  static std::span<const std::byte> TakeFrame(ConnectionState &conn) noexcept {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    return conn.closed ? std::span<const std::byte>() : TakeFrameLocked(conn.async);
+  }
+
+  /**
+   * @brief Hands the output of a coroutine over to the connection, and
+   * suspends the coroutine if the pending responses went past the high
+   * watermark.
+   * @param conn The connection.
+   * @param handle The coroutine.
+   * @return Whether the coroutine was suspended.
+   */
+  bool WaitRoom(ConnectionState &conn, const std::coroutine_handle<> handle) noexcept {
+    const ConnPtr shared = conn.shared_from_this();
+    AsyncState &async = conn.async;
+    if (!SendConnection(*async.handler, shared, async.out)) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    if (conn.closed || conn.out.bytes() <= _options.write_high_watermark) {
+      return false;
+    }
+    async.wait = Wait::Write;
+    async.handle = handle;
+    ++async.wait_id;
+    return true;
+  }
+
+  /**
+   * @brief Suspends a coroutine on a timer of the reactor serving its
+   * connection.
+   * @param conn The connection.
+   * @param delay How long to wait.
+   * @param handle The coroutine.
+   * @return Whether the coroutine was suspended.
+   */
+  static bool WaitTimer(ConnectionState &conn, const std::chrono::nanoseconds delay,
+                        const std::coroutine_handle<> handle) {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    AsyncState &async = conn.async;
+    if (conn.closed) {
+      return false;
+    }
+
+    // Arm the timer before waiting on it, it may not fit
+    const Clock::time_point deadline = Clock::now() + std::chrono::ceil<Clock::duration>(delay);
+    Reactor &reactor = conn.reactor;
+    {
+      std::lock_guard<std::mutex> reactor_lock(reactor.mutex);
+      reactor.timers.push({.deadline = deadline, .conn = conn.shared_from_this(), .wait_id = async.wait_id + 1});
+      WakeReactorLocked(reactor, deadline);
+    }
+    async.wait = Wait::Sleep;
+    async.handle = handle;
+    ++async.wait_id;
+    return true;
+  }
+
+  /**
+   * @brief Returns whether a connection is still open.
+   * @param conn The connection.
+   * @return Whether the connection is open.
+   */
+  static bool IsOpen(ConnectionState &conn) noexcept {
+    std::lock_guard<std::mutex> lock(conn.mutex);
+    return !conn.closed;
+  }
+
+  /// @brief The operations coroutine handlers wait on.
+  static constexpr Io::Ops kIoOps = {
+      .read = [](void *, void *conn, std::coroutine_handle<> handle) {
+        return WaitFrame(*static_cast<ConnectionState *>(conn), handle);
+      },
+      .read_result = [](void *, void *conn) { return TakeFrame(*static_cast<ConnectionState *>(conn)); },
+      .write = [](void *server, void *conn, std::coroutine_handle<> handle) {
+        return static_cast<Server *>(server)->WaitRoom(*static_cast<ConnectionState *>(conn), handle);
+      },
+      .is_open = [](void *, void *conn) { return IsOpen(*static_cast<ConnectionState *>(conn)); },
+      .sleep = [](void *, void *conn, std::chrono::nanoseconds delay, std::coroutine_handle<> handle) {
+        return WaitTimer(*static_cast<ConnectionState *>(conn), delay, handle);
+      },
+  };
+
+  /// @brief How many buffers worth of data an edge triggered socket may be
+  /// drained of per event.
+  static constexpr std::size_t kMaxDrainChunks = 16;
+
+  // -- Member Variables --
+  /// @brief The addresses to listen on.
+  std::vector<Address> _listeners;
   /// @brief The receive buffer size.
   std::size_t _buf_size;
   /// @brief The maximum number of events to wait for at a time.
   int _max_events;
 
-  /// @brief The server socket's file descriptor.
-  int _server_fd;
+  /// @brief Optional server settings.
+  Options _options;
+  /// @brief The shortest timeout kept, zero if none is.
+  std::chrono::milliseconds _min_timeout{0};
+  /// @brief When tick zero of the timing wheels starts.
+  Clock::time_point _epoch{Clock::now()};
+
+  /// @brief The reactors, one unless running a reactor per thread. They stay
+  /// where they are, connections refer to them.
+  std::deque<Reactor> _reactors;
+
+  /// @brief One handler per pool worker followed by one per reactor, when
+  /// running with a handler factory.
+  std::vector<std::unique_ptr<Handler>> _handlers;
+
+  /// @brief The handler shared by all threads, when running with one.
+  Handler *_shared_handler{nullptr};
+
+  /// @brief Whether the server was stopped.
+  std::atomic<bool> _stopping{false};
+  /// @brief Tasks handed to the thread pool that did not run yet, on a cache
+  /// line of its own.
+  alignas(kCacheLineSize) std::atomic<std::size_t> _in_flight{0};
+
+  /// @brief Guards the reactors' listening sockets while they are handed to
+  /// a newer process, or closed.
+  std::mutex _listen_mutex;
+  /// @brief The socket newer processes restarting the server connect to, -1
+  /// without Options::handoff_path.
+  int _handoff_fd{-1};
+  /// @brief The connection to the newer process taking the listening sockets
+  /// over, -1 if none is. Only touched by the first reactor.
+  int _successor_fd{-1};
+  /// @brief The connection to the server being restarted, until its sockets
+  /// are listened on.
+  int _predecessor_fd{-1};
+  /// @brief Whether the listening sockets were taken over by a newer
+  /// process. Only touched by the first reactor.
+  bool _handed_off{false};
+
+#ifdef TCP_TLS
+  /// @brief The TLS configuration, without Options::tls_cert_file none.
+  std::unique_ptr<TlsContext> _tls;
+#endif
 
   /// @brief Thread pool for handling connections events.
   ThreadPool _thread_pool;
+  /// @brief The metrics of every pool worker.
+  std::unique_ptr<ThreadMetrics[]> _worker_metrics;
 };
 
 }  // namespace tcp
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+
+#include "utils.h"
+
+namespace tcp {
+
+/**
+ * @brief Kernel settings of the listening and client sockets. The defaults
+ * leave every setting to the kernel.
+ *
+ * Everything is set on the listening sockets when the server is created,
+ * failing loudly, and accepted connections inherit it. Only IP sockets are
+ * set up, Unix domain connections do not inherit anything.
+ * SO_INCOMING_CPU depends on the reactor, see Options::incoming_cpu.
+ */
+struct SocketOptions {
+  /**
+   * @brief Settings for request/response traffic with small messages, where
+   * every microsecond of latency counts. Spends CPU on busy polling, where
+   * the process may enable it.
+   * @return The settings.
+   */
+  [[nodiscard]] static SocketOptions Latency() noexcept {
+    return {.no_delay = true, .quick_ack = true, .busy_poll = std::chrono::microseconds(50), .prefer_busy_poll = true};
+  }
+
+  /**
+   * @brief Settings for bulk traffic, where fewer wake ups and larger windows
+   * count more than latency.
+   * @return The settings.
+   */
+  [[nodiscard]] static SocketOptions Throughput() noexcept {
+    return {.defer_accept = std::chrono::seconds(1), .recv_buffer = 4 << 20, .send_buffer = 4 << 20};
+  }
+
+  /// @brief Sends small responses right away instead of coalescing them
+  /// (TCP_NODELAY). Output already batches what a flush sends.
+  bool no_delay = false;
+
+  /// @brief Acknowledges received data right away instead of delaying the
+  /// ACK for a response to carry it (TCP_QUICKACK). The kernel may fall back
+  /// to delayed ACKs, so the server sets it again after every read.
+  bool quick_ack = false;
+
+  /// @brief Only reports connections once their first bytes arrived, or this
+  /// long after (TCP_DEFER_ACCEPT), zero to report them on the handshake.
+  /// Delays the welcome of protocols where the server speaks first.
+  std::chrono::seconds defer_accept{0};
+
+  /// @brief Busy polls the device queue this long for data before sleeping
+  /// in reads and waits (SO_BUSY_POLL), zero not to. Raising it above the
+  /// net.core.busy_read sysctl needs CAP_NET_ADMIN, without it the setting
+  /// is skipped.
+  std::chrono::microseconds busy_poll{0};
+
+  /// @brief Lets busy polling take over the device queue from interrupts
+  /// while the application keeps polling (SO_PREFER_BUSY_POLL). Needs
+  /// CAP_NET_ADMIN like busy_poll, without it the setting is skipped.
+  bool prefer_busy_poll = false;
+
+  /// @brief Receive buffer size in bytes (SO_RCVBUF), zero for the kernel's
+  /// autotuning. Set on the listening sockets so the window scale of new
+  /// connections accounts for it.
+  int recv_buffer = 0;
+
+  /// @brief Send buffer size in bytes (SO_SNDBUF), zero for the kernel's
+  /// autotuning.
+  int send_buffer = 0;
+
+  /// @brief Pending TCP Fast Open requests of each listening socket
+  /// (TCP_FASTOPEN), so clients resuming may send data in the SYN. Zero
+  /// disables it.
+  int fast_open = 0;
+};
+
+/**
+ * @brief Sets an integer socket option.
+ * @param fd The socket.
+ * @param level The protocol level of the option.
+ * @param name The option.
+ * @param value The value.
+ * @return Whether it was set.
+ */
+[[nodiscard]] inline bool SetSocketOption(const int fd, const int level, const int name, const int value) noexcept {
+  return setsockopt(fd, level, name, &value, sizeof(value)) == 0;
+}
+
+/**
+ * @brief Sets an integer socket option that needs privileges the process may
+ * lack, skipping it then.
+ * @param fd The socket.
+ * @param level The protocol level of the option.
+ * @param name The option.
+ * @param value The value.
+ * @return Whether it was set or skipped for lack of privileges.
+ */
+[[nodiscard]] inline bool SetPrivilegedSocketOption(const int fd, const int level, const int name,
+                                                    const int value) noexcept {
+  return SetSocketOption(fd, level, name, value) || errno == EPERM;
+}
+
+/**
+ * @brief Sets the socket options of a listening socket, which its
+ * connections inherit. Must run before it listens for the buffer sizes to
+ * count in the window scale. Unix domain sockets are left alone.
+ * @param server_fd The listening socket.
+ * @param family The address family of the socket.
+ * @param options The socket options.
+ */
+inline void ApplyListenerOptions(const int server_fd, const int family, const SocketOptions &options) {
+  if (family != AF_INET && family != AF_INET6) {
+    return;
+  }
+  const bool ok =
+      (options.recv_buffer == 0 || SetSocketOption(server_fd, SOL_SOCKET, SO_RCVBUF, options.recv_buffer)) &&
+      (options.send_buffer == 0 || SetSocketOption(server_fd, SOL_SOCKET, SO_SNDBUF, options.send_buffer)) &&
+      (!options.no_delay || SetSocketOption(server_fd, IPPROTO_TCP, TCP_NODELAY, 1)) &&
+      (!options.quick_ack || SetSocketOption(server_fd, IPPROTO_TCP, TCP_QUICKACK, 1)) &&
+      (options.defer_accept.count() == 0 ||
+       SetSocketOption(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, static_cast<int>(options.defer_accept.count()))) &&
+      (options.fast_open == 0 || SetSocketOption(server_fd, IPPROTO_TCP, TCP_FASTOPEN, options.fast_open)) &&
+      (options.busy_poll.count() == 0 ||
+       SetPrivilegedSocketOption(server_fd, SOL_SOCKET, SO_BUSY_POLL, static_cast<int>(options.busy_poll.count()))) &&
+      (!options.prefer_busy_poll || SetPrivilegedSocketOption(server_fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, 1));
+  if (!ok) {
+    throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+  }
+}
+
+/**
+ * @brief Sets TCP_QUICKACK on a client socket again, which the kernel clears
+ * once it thinks the connection is interactive.
+ * @param client_fd The client socket.
+ */
+inline void RearmQuickAck(const int client_fd) noexcept {
+  static_cast<void>(SetSocketOption(client_fd, IPPROTO_TCP, TCP_QUICKACK, 1));
+}
+
+}  // namespace tcp
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tcp {
+
+/**
+ * @brief Move-only, type-erased `void()` callable.
+ *
+ * Callables that fit in the inline buffer and are nothrow movable are stored
+ * in place, so queueing one costs no allocation and no reference counting.
+ * Larger callables fall back to a single heap allocation. An empty task
+ * compares false.
+ */
+class Task {
+ public:
+  /// @brief Bytes available for storing a callable in place. Together with
+  /// the dispatch table pointer a task fills exactly one cache line.
+  static constexpr std::size_t kInlineSize = 56;
+
+  /**
+   * @brief Creates an empty task.
+   */
+  Task() noexcept = default;
+
+  /**
+   * @brief Wraps a callable.
+   * @param f The callable.
+   */
+  template <typename F>
+    requires(!std::same_as<std::remove_cvref_t<F>, Task> && std::invocable<std::decay_t<F> &>)
+  Task(F &&f) {  // NOLINT(google-explicit-constructor)
+    using Fn = std::decay_t<F>;
+    if constexpr (kFitsInline<Fn>) {
+      ::new (static_cast<void *>(_storage)) Fn(std::forward<F>(f));
+      _ops = &kInlineOps<Fn>;
+    } else {
+      ::new (static_cast<void *>(_storage)) Fn *(new Fn(std::forward<F>(f)));
+      _ops = &kHeapOps<Fn>;
+    }
+  }
+
+  /**
+   * @brief Takes over the callable of another task.
+   * @param other The task to take the callable from.
+   */
+  Task(Task &&other) noexcept : _ops(std::exchange(other._ops, nullptr)) {
+    if (_ops != nullptr) {
+      _ops->relocate(_storage, other._storage);
+    }
+  }
+
+  /**
+   * @brief Destroys the current callable and takes over the one of another
+   * task.
+   * @param other The task to take the callable from.
+   * @return This task.
+   */
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      Reset();
+      _ops = std::exchange(other._ops, nullptr);
+      if (_ops != nullptr) {
+        _ops->relocate(_storage, other._storage);
+      }
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  /**
+   * @brief Destroys the callable.
+   */
+  ~Task() noexcept { Reset(); }
+
+  /**
+   * @brief Calls the callable. The task must not be empty.
+   */
+  void operator()() { _ops->invoke(_storage); }
+
+  /**
+   * @brief Returns whether the task holds a callable.
+   * @return Whether the task holds a callable.
+   */
+  explicit operator bool() const noexcept { return _ops != nullptr; }
+
+ private:
+  /// @brief Type-erased operations on the stored callable.
+  struct Ops {
+    /// @brief Calls the callable.
+    void (*invoke)(void *storage);
+    /// @brief Moves the callable to another storage and destroys the source.
+    void (*relocate)(void *dst, void *src) noexcept;
+    /// @brief Destroys the callable.
+    void (*destroy)(void *storage) noexcept;
+  };
+
+  /// @brief Whether a callable type can be stored in place.
+  template <typename Fn>
+  static constexpr bool kFitsInline = sizeof(Fn) <= kInlineSize &&
+                                      alignof(Fn) <= alignof(std::max_align_t) &&
+                                      std::is_nothrow_move_constructible_v<Fn>;
+
+  /// @brief Operations for callables stored in place.
+  template <typename Fn>
+  static constexpr Ops kInlineOps{
+      .invoke = [](void *storage) { std::invoke(*std::launder(static_cast<Fn *>(storage))); },
+      .relocate =
+          [](void *dst, void *src) noexcept {
+            Fn *from = std::launder(static_cast<Fn *>(src));
+            ::new (dst) Fn(std::move(*from));
+            from->~Fn();
+          },
+      .destroy = [](void *storage) noexcept { std::launder(static_cast<Fn *>(storage))->~Fn(); },
+  };
+
+  /// @brief Operations for callables stored on the heap.
+  template <typename Fn>
+  static constexpr Ops kHeapOps{
+      .invoke = [](void *storage) { std::invoke(**std::launder(static_cast<Fn **>(storage))); },
+      .relocate =
+          [](void *dst, void *src) noexcept { ::new (dst) Fn *(*std::launder(static_cast<Fn **>(src))); },
+      .destroy = [](void *storage) noexcept { delete *std::launder(static_cast<Fn **>(storage)); },
+  };
+
+  /**
+   * @brief Destroys the callable, if any, leaving the task empty.
+   */
+  void Reset() noexcept {
+    if (_ops != nullptr) {
+      std::exchange(_ops, nullptr)->destroy(_storage);
+    }
+  }
+
+  /// @brief Storage for the callable, or for a pointer to it.
+  alignas(std::max_align_t) std::byte _storage[kInlineSize];
+  /// @brief Operations on the stored callable, null when empty.
+  const Ops *_ops{nullptr};
+};
+
+}  // namespace tcp
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
@@ -15,21 +20,76 @@
 #include <utility>
 #include <vector>
 
+#include "mpmc_queue.h"
+#include "task.h"
+#include "utils.h"
+#include "work_stealing_deque.h"
+
 class ThreadPool {
-    using task_type = std::function<void()>;
+    using task_type = tcp::Task;
 
 public:
-    [[nodiscard]] explicit ThreadPool(std::size_t num) {
+    /// @brief Queue the workers take their tasks from.
+    enum class Queue {
+        /// @brief Unbounded queue guarded by a mutex and a condition variable.
+        Locked,
+        /// @brief Bounded lock-free ring. Idle workers spin for a while before
+        /// parking, and producers only make a syscall when a worker is parked.
+        LockFree,
+        /// @brief Per-worker lists of lanes. Tasks posted with the same key share
+        /// a lane, and run in order, one at a time, on the worker that ran the
+        /// previous ones. Idle workers steal whole lanes from busy ones.
+        Affinity,
+        /// @brief A bounded lock-free inbox and a work-stealing deque per worker.
+        /// Tasks go to the inbox their key picks, or are spread over the inboxes,
+        /// workers move them to their deque a few at a time, and idle workers
+        /// steal from a random victim, so short tasks do not wait behind a long
+        /// one. A stolen task may overtake the earlier ones of its key.
+        WorkStealing,
+    };
+
+    // worker i is pinned to cpus[i % cpus.size()], unpinned if cpus is empty
+    [[nodiscard]] explicit ThreadPool(std::size_t num, Queue queue = Queue::Locked,
+                                      std::size_t capacity = 4096, std::vector<int> cpus = {}) {
+        for (const int cpu: cpus) {
+            if (!tcp::IsCpuAvailable(cpu)) {
+                throw tcp::Error("Invalid worker CPU.", tcp::Error::Kind::ThreadAffinity);
+            }
+        }
+        if (queue == Queue::LockFree) {
+            ring_ = std::make_unique<tcp::MpmcQueue<task_type>>(capacity);
+        } else if (queue == Queue::Affinity && num > 0) {
+            lanes_ = std::vector<lane>(num * lanes_per_worker);
+            for (std::size_t i = 0; i < lanes_.size(); ++i) {
+                lanes_[i].home = i % num;
+            }
+            for (std::size_t i = 0; i < num; ++i) {
+                queues_.push_back(std::make_unique<lane_queue>());
+            }
+        } else if (queue == Queue::WorkStealing && num > 0) {
+            for (std::size_t i = 0; i < num; ++i) {
+                stealers_.push_back(std::make_unique<steal_queue>(capacity));
+            }
+        }
         for (std::size_t i = 0; i < num; ++i) {
-            workers_.emplace_back([this] {
+            const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+            workers_.emplace_back([this, i, cpu] {
+                // pinned before anything is allocated, so the worker's memory
+                // comes from its own node. The CPU was checked above
+                if (cpu != -1) {
+                    static_cast<void>(tcp::PinThread(cpu));
+                }
+                current_worker_ = i;
+                current_pool_ = this;
+                if (!lanes_.empty()) {
+                    run_lanes(i);
+                    return;
+                } else if (!stealers_.empty()) {
+                    run_stealing(i);
+                    return;
+                }
                 while (true) {
-                    task_type task;
-                    {
-                        std::unique_lock<std::mutex> lock(task_mutex_);
-                        task_cond_.wait(lock, [this] { return !tasks_.empty(); });
-                        task = std::move(tasks_.front());
-                        tasks_.pop();
-                    }
+                    task_type task = ring_ ? pop_ring() : pop_locked();
                     if (!task) {
                         push_stop_task();
                         return;
@@ -44,8 +104,77 @@ public:
         Stop();
     }
 
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    // index of the calling thread among the workers of its pool, npos when
+    // called from a thread that is not a worker
+    [[nodiscard]] static std::size_t CurrentWorker() noexcept {
+        return current_worker_;
+    }
+
+    [[nodiscard]] std::size_t Size() const noexcept {
+        return workers_.size();
+    }
+
+    // number of keys Post tells apart: the lanes of the affinity queue, the
+    // workers of the work-stealing one, and of the others, which ignore keys
+    [[nodiscard]] std::size_t Lanes() const noexcept {
+        if (!stealers_.empty()) {
+            return stealers_.size();
+        }
+        if (!lanes_.empty()) {
+            return lanes_.size();
+        }
+        return std::max<std::size_t>(workers_.size(), 1);
+    }
+
+    // lane of the tasks posted with a key, tasks posted with keys sharing one
+    // are ordered with each other as Post describes
+    [[nodiscard]] std::size_t LaneOf(std::size_t key) const noexcept {
+        return key % Lanes();
+    }
+
+    // approximate number of tasks waiting for a worker, locking the queues
+    // that have locks for a moment
+    [[nodiscard]] std::size_t Pending() {
+        if (ring_) {
+            return ring_->ApproxSize();
+        }
+        if (!stealers_.empty()) {
+            std::size_t pending = 0;
+            for (auto &queue: stealers_) {
+                pending += queue->deque.ApproxSize() + queue->inbox.ApproxSize();
+            }
+            return pending;
+        }
+        if (!lanes_.empty()) {
+            std::size_t pending = 0;
+            for (lane &l: lanes_) {
+                std::lock_guard<std::mutex> lock(l.mutex);
+                pending += l.tasks.size();
+            }
+            return pending;
+        }
+        std::lock_guard<std::mutex> lock(task_mutex_);
+        return tasks_.size();
+    }
+
+    // stops the workers. The shared queues run the tasks queued before the
+    // stop, the per-worker ones drop them
     void Stop() {
-        push_stop_task();
+        if (!lanes_.empty() || !stealers_.empty()) {
+            stopping_.store(true);
+            for (auto &queue: queues_) {
+                queue->epoch.fetch_add(1);
+                queue->epoch.notify_one();
+            }
+            for (auto &queue: stealers_) {
+                queue->epoch.fetch_add(1);
+                queue->epoch.notify_one();
+            }
+        } else {
+            push_stop_task();
+        }
         for (auto &worker: workers_) {
             if (worker.joinable()) {
                 worker.join();
@@ -55,34 +184,420 @@ public:
         // clear all pending tasks
         std::queue<task_type> empty{};
         std::swap(tasks_, empty);
+        if (ring_) {
+            task_type task;
+            while (ring_->TryPop(task)) {
+            }
+        }
+        for (lane &l: lanes_) {
+            l.tasks.clear();
+        }
+        for (auto &queue: stealers_) {
+            task_type task;
+            while (queue->deque.TryPop(task) || queue->inbox.TryPop(task)) {
+            }
+        }
+    }
+
+    // like Stop, but only once every task posted before the call ran. Tasks
+    // posted after it, by the running ones too, may be dropped once the
+    // workers start exiting, so callers wait for those before draining
+    void Drain() {
+        draining_.store(true);
+        Stop();
     }
 
     template<typename F, typename... Args>
     auto Push(F &&f, Args &&... args) {
         using return_type = std::invoke_result_t<F, Args...>;
-        auto task
-                = std::make_shared<std::packaged_task<return_type()>>(
-                        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-        auto res = task->get_future();
+        std::packaged_task<return_type()> task(
+                std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        auto res = task.get_future();
+        push_task(std::move(task));
+        return res;
+    }
+
+    // fire and forget: the callable is stored in the task itself, there is no
+    // future, no shared state and no reference counting
+    template<typename F>
+    void Post(F &&f) {
+        push_task(task_type(std::forward<F>(f)));
+    }
+
+    // fire and forget, in order behind the other tasks posted with the same
+    // key. Only the affinity queue keeps the order, the work-stealing queue
+    // only starts them in order unless one is stolen, the others ignore the key
+    template<typename F>
+    void Post(std::size_t key, F &&f) {
+        if (!stealers_.empty()) {
+            push_stealing(LaneOf(key), task_type(std::forward<F>(f)));
+            return;
+        }
+        if (lanes_.empty()) {
+            Post(std::forward<F>(f));
+            return;
+        }
+        push_lane_task(lanes_[LaneOf(key)], task_type(std::forward<F>(f)));
+    }
+
+private:
+    static constexpr int spin_count = 256;
+
+    // lanes per worker, keys sharing a lane are serialized with each other
+    static constexpr std::size_t lanes_per_worker = 64;
+
+    // tasks a worker runs off a lane before giving the others a turn
+    static constexpr std::size_t lane_batch = 16;
+
+    // serial queue of the tasks of some keys, on at most one worker list at a
+    // time
+    struct lane {
+        std::mutex mutex;
+        std::deque<task_type> tasks;
+        // on a worker list or running, guarded by the mutex
+        bool queued = false;
+        // the worker that ran it last, guarded by the mutex
+        std::size_t home = 0;
+    };
+
+    // where a worker of the per-worker queues parks: on its epoch, announced in
+    // parked
+    struct parking {
+        std::atomic<std::uint32_t> epoch{0};
+        std::atomic<bool> parked{false};
+    };
+
+    // the lanes waiting for a worker
+    struct alignas(tcp::kCacheLineSize) lane_queue : parking {
+        std::mutex mutex;
+        std::deque<lane *> ready;
+        std::atomic<std::size_t> size{0};
+    };
+
+    // tasks a worker moves from its inbox to its deque at a time, the rest of
+    // the inbox stays available to thieves as well
+    static constexpr std::size_t steal_batch = 8;
+
+    // the tasks of a worker
+    struct alignas(tcp::kCacheLineSize) steal_queue : parking {
+        explicit steal_queue(std::size_t capacity) : inbox(capacity) {}
+
+        // only pushed to and popped by the worker, stolen from by the others
+        tcp::WorkStealingDeque<task_type> deque{steal_batch};
+        // pushed to by the other threads, popped by anybody
+        tcp::MpmcQueue<task_type> inbox;
+    };
 
+    void push_stop_task() {
+        push_task({});
+    }
+
+    void push_task(task_type &&task) {
+        if (!stealers_.empty()) {
+            // workers keep what they post, the others spread it
+            const std::size_t worker = current_pool_ == this
+                    ? current_worker_
+                    : next_lane_.fetch_add(1, std::memory_order_relaxed) % stealers_.size();
+            push_stealing(worker, std::move(task));
+            return;
+        }
+        if (!lanes_.empty()) {
+            push_lane_task(lanes_[next_lane_.fetch_add(1, std::memory_order_relaxed) % lanes_.size()],
+                           std::move(task));
+            return;
+        }
+        if (ring_) {
+            push_ring(std::move(task));
+            return;
+        }
         {
             std::lock_guard<std::mutex> lock(task_mutex_);
-            tasks_.emplace([task] { (*task)(); });
+            tasks_.push(std::move(task));
         }
         task_cond_.notify_one();
+    }
 
-        return res;
+    task_type pop_locked() {
+        std::unique_lock<std::mutex> lock(task_mutex_);
+        task_cond_.wait(lock, [this] { return !tasks_.empty(); });
+        task_type task = std::move(tasks_.front());
+        tasks_.pop();
+        return task;
     }
 
-private:
-    void push_stop_task() {
-        std::lock_guard<std::mutex> lock(task_mutex_);
-        tasks_.emplace();
-        task_cond_.notify_one();
+    void push_ring(task_type &&task) {
+        // a full ring applies backpressure to the producer
+        while (!ring_->TryPush(std::move(task))) {
+            std::this_thread::yield();
+        }
+
+        // only pay for a wake up when somebody is actually parked
+        if (sleepers_.load() > 0) {
+            epoch_.fetch_add(1);
+            epoch_.notify_one();
+        }
+    }
+
+    task_type pop_ring() {
+        task_type task;
+        while (true) {
+            for (int i = 0; i < spin_count; ++i) {
+                if (ring_->TryPop(task)) {
+                    return task;
+                }
+                tcp::CpuRelax();
+            }
+
+            // announce ourselves before the last check, so a producer either
+            // sees us parked or we see its task
+            const auto epoch = epoch_.load();
+            sleepers_.fetch_add(1);
+            if (ring_->TryPop(task)) {
+                sleepers_.fetch_sub(1);
+                return task;
+            }
+            epoch_.wait(epoch);
+            sleepers_.fetch_sub(1);
+        }
+    }
+
+    void push_lane_task(lane &l, task_type &&task) {
+        bool schedule = false;
+        std::size_t home = 0;
+        {
+            std::lock_guard<std::mutex> lock(l.mutex);
+            l.tasks.push_back(std::move(task));
+            schedule = !l.queued;
+            l.queued = true;
+            home = l.home;
+        }
+        if (schedule) {
+            push_lane(home, l);
+        }
+    }
+
+    void push_lane(std::size_t worker, lane &l) {
+        lane_queue &queue = *queues_[worker];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.ready.push_back(&l);
+        }
+        queue.size.fetch_add(1);
+
+        // wake the owner if it is parked, otherwise somebody that can steal the
+        // lane while the owner is busy
+        wake_for(queues_, worker);
+    }
+
+    template<typename Queues>
+    static void wake_for(Queues &queues, std::size_t worker) {
+        for (std::size_t i = 0; i < queues.size(); ++i) {
+            if (wake(*queues[(worker + i) % queues.size()])) {
+                return;
+            }
+        }
+    }
+
+    static bool wake(parking &spot) {
+        if (!spot.parked.load()) {
+            return false;
+        }
+        spot.epoch.fetch_add(1);
+        spot.epoch.notify_one();
+        return true;
+    }
+
+    // spins on take, then parks until woken up. Returns false once stopping,
+    // or once stopping and out of work when draining
+    template<typename F>
+    bool park_until(parking &spot, F &&take) {
+        while (true) {
+            for (int i = 0; i < spin_count; ++i) {
+                // when draining, stop once nothing is left after stopping
+                const bool stopping = stopping_.load();
+                if (stopping && !draining_.load()) {
+                    return false;
+                }
+                if (take()) {
+                    return true;
+                }
+                if (stopping) {
+                    return false;
+                }
+                tcp::CpuRelax();
+            }
+
+            // announce ourselves before the last check, so a producer either
+            // sees us parked or we see its work
+            const auto epoch = spot.epoch.load();
+            spot.parked.store(true);
+            if (take()) {
+                spot.parked.store(false);
+                return true;
+            }
+            if (!stopping_.load()) {
+                spot.epoch.wait(epoch);
+            }
+            spot.parked.store(false);
+        }
+    }
+
+    void run_lanes(std::size_t self) {
+        while (lane *l = pop_lane(self)) {
+            run_lane(*l, self);
+        }
+    }
+
+    void run_lane(lane &l, std::size_t self) {
+        for (std::size_t i = 0; i < lane_batch; ++i) {
+            task_type task;
+            {
+                std::lock_guard<std::mutex> lock(l.mutex);
+                if (l.tasks.empty()) {
+                    l.queued = false;
+                    return;
+                }
+                task = std::move(l.tasks.front());
+                l.tasks.pop_front();
+            }
+            task();
+        }
+
+        // more to do, go to the back of the own list
+        {
+            std::lock_guard<std::mutex> lock(l.mutex);
+            if (l.tasks.empty()) {
+                l.queued = false;
+                return;
+            }
+        }
+        push_lane(self, l);
+    }
+
+    lane *pop_lane(std::size_t self) {
+        lane *l = nullptr;
+        park_until(*queues_[self], [&] { return (l = take_lane(self)) != nullptr; });
+        return l;
+    }
+
+    lane *take_lane(std::size_t self) {
+        // own lanes first, oldest first
+        if (lane *l = pop_ready(*queues_[self], true)) {
+            return l;
+        }
+
+        // then steal the lane that waited the least from somebody else, it is
+        // the least likely to be warm in their cache
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            if (lane *l = pop_ready(*queues_[(self + i) % queues_.size()], false)) {
+                std::lock_guard<std::mutex> lock(l->mutex);
+                l->home = self;
+                return l;
+            }
+        }
+        return nullptr;
+    }
+
+    static lane *pop_ready(lane_queue &queue, bool front) {
+        if (queue.size.load() == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.ready.empty()) {
+            return nullptr;
+        }
+        lane *l = front ? queue.ready.front() : queue.ready.back();
+        if (front) {
+            queue.ready.pop_front();
+        } else {
+            queue.ready.pop_back();
+        }
+        queue.size.fetch_sub(1);
+        return l;
+    }
+
+    void push_stealing(std::size_t worker, task_type &&task) {
+        // only the owner pushes to a deque, and popping it is last in first
+        // out, so everybody posts to the inboxes. A full one applies
+        // backpressure to the producer
+        while (!stealers_[worker]->inbox.TryPush(std::move(task))) {
+            std::this_thread::yield();
+        }
+
+        // wake the owner if it is parked, otherwise somebody that can steal the
+        // task while the owner is busy
+        wake_for(stealers_, worker);
     }
 
+    void run_stealing(std::size_t self) {
+        task_type task;
+        while (park_until(*stealers_[self], [&] { return take_stealing(self, task); })) {
+            task();
+            task = {};
+        }
+    }
+
+    bool take_stealing(std::size_t self, task_type &task) {
+        steal_queue &own = *stealers_[self];
+        if (own.deque.TryPop(task)) {
+            return true;
+        }
+
+        // move a few tasks from the inbox, newest first so they are popped
+        // oldest first
+        std::array<task_type, steal_batch> batch;
+        std::size_t n = 0;
+        while (n < steal_batch && own.inbox.TryPop(batch[n])) {
+            ++n;
+        }
+        if (n > 0) {
+            // the deque was just found empty, so there is room for the batch
+            for (std::size_t i = n - 1; i > 0; --i) {
+                [[maybe_unused]] const bool pushed = own.deque.TryPush(std::move(batch[i]));
+                assert(pushed);
+            }
+            task = std::move(batch[0]);
+            return true;
+        }
+
+        // then steal from a random victim, from its deque or its inbox
+        const std::size_t start = next_random();
+        for (std::size_t i = 0; i < stealers_.size(); ++i) {
+            const std::size_t victim = (start + i) % stealers_.size();
+            if (victim != self &&
+                (stealers_[victim]->deque.TrySteal(task) || stealers_[victim]->inbox.TryPop(task))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static std::size_t next_random() noexcept {
+        static thread_local std::uint64_t state =
+                0x9e3779b97f4a7c15ULL ^ reinterpret_cast<std::uintptr_t>(&state);
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return static_cast<std::size_t>(state);
+    }
+
+    static inline thread_local std::size_t current_worker_ = npos;
+    static inline thread_local const ThreadPool *current_pool_ = nullptr;
+
     std::vector<std::thread> workers_;
     std::queue<task_type> tasks_;
     std::mutex task_mutex_;
     std::condition_variable task_cond_;
+
+    std::unique_ptr<tcp::MpmcQueue<task_type>> ring_;
+
+    std::vector<lane> lanes_;
+    std::vector<std::unique_ptr<lane_queue>> queues_;
+    std::vector<std::unique_ptr<steal_queue>> stealers_;
+    std::atomic<std::size_t> next_lane_{0};
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> draining_{false};
+
+    alignas(tcp::kCacheLineSize) std::atomic<std::uint32_t> epoch_{0};
+    alignas(tcp::kCacheLineSize) std::atomic<std::uint32_t> sleepers_{0};
 };
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace tcp {
+
+/**
+ * @brief Hierarchical timing wheel of intrusive timers, owned by a single
+ * thread.
+ *
+ * Time is counted in ticks. Scheduling and cancelling a timer is constant
+ * time and never allocates: the timer is a node embedded in whatever it
+ * times, linked into one of the slots of the wheel. Timers far in the future
+ * sit in the coarser levels and move down a level every time the finer one
+ * wraps around, so expiring them is constant time per level as well.
+ */
+class TimerWheel {
+ public:
+  /// @brief A timer, embedded in whatever it times.
+  struct Node {
+    /// @brief The previous node in the slot, null while not scheduled.
+    Node *prev{nullptr};
+    /// @brief The next node in the slot, null while not scheduled.
+    Node *next{nullptr};
+    /// @brief The tick the timer expires at.
+    std::uint64_t expiry{0};
+
+    /**
+     * @brief Returns whether the timer is scheduled.
+     * @return Whether the timer is scheduled.
+     */
+    [[nodiscard]] bool scheduled() const noexcept { return next != nullptr; }
+  };
+
+  /// @brief The tick returned by NextExpiry for an empty wheel.
+  static constexpr std::uint64_t kNever = std::numeric_limits<std::uint64_t>::max();
+
+  /**
+   * @brief Creates an empty wheel at tick zero.
+   */
+  TimerWheel() noexcept {
+    for (auto &level : _slots) {
+      for (Node &slot : level) {
+        slot.prev = &slot;
+        slot.next = &slot;
+      }
+    }
+  }
+
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  /**
+   * @brief Returns the current tick.
+   * @return The current tick.
+   */
+  [[nodiscard]] std::uint64_t now() const noexcept { return _now; }
+
+  /**
+   * @brief Returns the number of scheduled timers.
+   * @return The number of timers.
+   */
+  [[nodiscard]] std::size_t size() const noexcept { return _size; }
+
+  /**
+   * @brief Schedules a timer, moving it if it was scheduled already. Timers
+   * due by now expire on the next tick.
+   * @param node The timer.
+   * @param expiry The tick it expires at.
+   */
+  void Schedule(Node &node, const std::uint64_t expiry) noexcept {
+    Cancel(node);
+    node.expiry = expiry > _now ? expiry : _now + 1;
+    Insert(node);
+    ++_size;
+  }
+
+  /**
+   * @brief Cancels a timer, if it is scheduled.
+   * @param node The timer.
+   */
+  void Cancel(Node &node) noexcept {
+    if (node.scheduled()) {
+      Unlink(node);
+      --_size;
+    }
+  }
+
+  /**
+   * @brief Moves the wheel forward, expiring the timers due by then. An
+   * expired timer is no longer scheduled, the callback may schedule it again.
+   * @param tick The tick to move to, earlier ticks are ignored.
+   * @param expire Called with every expired timer.
+   */
+  template <typename F>
+  void Advance(const std::uint64_t tick, F &&expire) {
+    while (_now < tick) {
+      // Nothing to expire on the way, jump straight there
+      if (_size == 0) {
+        _now = tick;
+        return;
+      }
+      ++_now;
+
+      // Move the timers of the coarser levels down once the finer ones wrap
+      // around
+      for (std::size_t level = 1; level < kLevels; ++level) {
+        if ((_now & ((std::uint64_t{1} << (level * kSlotBits)) - 1)) != 0) {
+          break;
+        }
+        Node pending;
+        Take(_slots[level][SlotOf(_now, level)], pending);
+        while (pending.next != &pending) {
+          Node &node = *pending.next;
+          Unlink(node);
+          Insert(node);
+        }
+      }
+
+      // Expire the timers of the tick
+      Node due;
+      Take(_slots[0][SlotOf(_now, 0)], due);
+      while (due.next != &due) {
+        Node &node = *due.next;
+        Unlink(node);
+        --_size;
+        expire(node);
+      }
+    }
+  }
+
+  /**
+   * @brief Returns the tick by which the wheel must be moved forward for its
+   * timers to expire on time. It may be earlier than the next expiry when
+   * that sits in a coarser level.
+   * @return The tick, kNever if no timer is scheduled.
+   */
+  [[nodiscard]] std::uint64_t NextExpiry() const noexcept {
+    if (_size == 0) {
+      return kNever;
+    }
+
+    // Look for the next tick with timers in the finest level
+    for (std::uint64_t tick = _now + 1; tick <= _now + kSlots; ++tick) {
+      const Node &slot = _slots[0][SlotOf(tick, 0)];
+      if (slot.next != &slot) {
+        return tick;
+      }
+    }
+
+    // Otherwise the next coarser slot moves down when the finest level wraps
+    return (_now | (kSlots - 1)) + 1;
+  }
+
+ private:
+  /// @brief Bits of a tick per level.
+  static constexpr std::size_t kSlotBits = 6;
+  /// @brief Slots per level.
+  static constexpr std::uint64_t kSlots = std::uint64_t{1} << kSlotBits;
+  /// @brief Levels of the wheel, timers further away than they span sit in
+  /// the last slot of the coarsest level until they come into range.
+  static constexpr std::size_t kLevels = 4;
+
+  /**
+   * @brief Returns the slot of a level a tick falls into.
+   * @param tick The tick.
+   * @param level The level.
+   * @return The slot.
+   */
+  [[nodiscard]] static std::size_t SlotOf(const std::uint64_t tick, const std::size_t level) noexcept {
+    return static_cast<std::size_t>((tick >> (level * kSlotBits)) & (kSlots - 1));
+  }
+
+  /**
+   * @brief Links a timer into the slot of its expiry, in the finest level
+   * that spans it.
+   * @param node The timer, not linked.
+   */
+  void Insert(Node &node) noexcept {
+    const std::uint64_t delta = node.expiry - _now;
+    std::size_t level = 0;
+    while (level + 1 < kLevels && delta >= (std::uint64_t{1} << ((level + 1) * kSlotBits))) {
+      ++level;
+    }
+
+    // Out of range, park it in the coarsest slot furthest away
+    std::uint64_t slot_tick = node.expiry;
+    if (delta >= (std::uint64_t{1} << (kLevels * kSlotBits))) {
+      slot_tick = _now + ((kSlots - 1) << (level * kSlotBits));
+    }
+
+    Node &slot = _slots[level][SlotOf(slot_tick, level)];
+    node.prev = slot.prev;
+    node.next = &slot;
+    slot.prev->next = &node;
+    slot.prev = &node;
+  }
+
+  /**
+   * @brief Unlinks a timer from its slot.
+   * @param node The timer, linked.
+   */
+  static void Unlink(Node &node) noexcept {
+    node.prev->next = node.next;
+    node.next->prev = node.prev;
+    node.prev = nullptr;
+    node.next = nullptr;
+  }
+
+  /**
+   * @brief Moves all the timers of a slot to an empty list.
+   * @param slot The slot.
+   * @param list The list, left circular even if the slot is empty.
+   */
+  static void Take(Node &slot, Node &list) noexcept {
+    if (slot.next == &slot) {
+      list.prev = &list;
+      list.next = &list;
+      return;
+    }
+    list.next = slot.next;
+    list.prev = slot.prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    slot.next = &slot;
+    slot.prev = &slot;
+  }
+
+  /// @brief The slots of every level, each the sentinel of a circular list.
+  std::array<std::array<Node, kSlots>, kLevels> _slots;
+  /// @brief The current tick.
+  std::uint64_t _now{0};
+  /// @brief The number of scheduled timers.
+  std::size_t _size{0};
+};
+
+}  // namespace tcp
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <memory>
+#include <string>
+
+#include "utils.h"
+
+namespace tcp {
+
+/// @brief Frees an OpenSSL session.
+struct TlsSessionDeleter {
+  void operator()(SSL *ssl) const noexcept { SSL_free(ssl); }
+};
+
+/// @brief An OpenSSL session, only alive while its handshake runs.
+using TlsSession = std::unique_ptr<SSL, TlsSessionDeleter>;
+
+/// @brief Where a handshake stands after a step.
+enum class Handshake {
+  /// @brief The handshake is done and the session was offloaded to the kernel.
+  Done,
+  /// @brief The handshake waits for the socket to be readable.
+  WantRead,
+  /// @brief The handshake waits for the socket to be writable.
+  WantWrite,
+  /// @brief The handshake failed, or the kernel did not take the session.
+  Failed,
+};
+
+/**
+ * @brief Server-side TLS configuration, whose sessions end up in kernel TLS.
+ *
+ * The handshake runs in user space with OpenSSL. Once it is done OpenSSL
+ * hands the keys of both directions to the kernel with setsockopt(SOL_TLS),
+ * and the session is freed: the socket then reads and writes plaintext, the
+ * kernel encrypting and decrypting the records in place. Only ciphers the
+ * kernel offloads are offered, and no session tickets are sent since the
+ * kernel would not know what to do with post-handshake messages.
+ */
+class TlsContext {
+ public:
+  /**
+   * @brief Creates a context serving a certificate.
+   * @param cert_file The PEM certificate chain.
+   * @param key_file The PEM private key.
+   */
+  [[nodiscard]] TlsContext(const std::string &cert_file, const std::string &key_file)
+      : _ctx(SSL_CTX_new(TLS_server_method())) {
+    if (_ctx == nullptr) {
+      throw Error("Failed to create TLS context.", Error::Kind::Tls);
+    }
+
+    // Offload both directions, with ciphers the kernel supports
+    SSL_CTX_set_options(_ctx.get(), SSL_OP_ENABLE_KTLS | SSL_OP_NO_TICKET | SSL_OP_NO_RENEGOTIATION);
+    SSL_CTX_set_num_tickets(_ctx.get(), 0);
+    SSL_CTX_set_min_proto_version(_ctx.get(), TLS1_2_VERSION);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    // Older OpenSSL cannot offload receiving TLS 1.3 records
+    SSL_CTX_set_max_proto_version(_ctx.get(), TLS1_2_VERSION);
+#endif
+    if (SSL_CTX_set_cipher_list(_ctx.get(), "ECDHE+AESGCM:ECDHE+CHACHA20") != 1 ||
+        SSL_CTX_set_ciphersuites(_ctx.get(), "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+                                             "TLS_CHACHA20_POLY1305_SHA256") != 1) {
+      throw Error("Failed to set TLS ciphers.", Error::Kind::Tls);
+    }
+
+    // Load the certificate and check it matches the key
+    if (SSL_CTX_use_certificate_chain_file(_ctx.get(), cert_file.c_str()) != 1 ||
+        SSL_CTX_use_PrivateKey_file(_ctx.get(), key_file.c_str(), SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(_ctx.get()) != 1) {
+      throw Error("Failed to load TLS certificate.", Error::Kind::Tls);
+    }
+  }
+
+  /**
+   * @brief Starts the server side of a session on a socket.
+   * @param fd The socket.
+   * @return The session, empty if it could not be created.
+   */
+  [[nodiscard]] TlsSession NewSession(const int fd) const noexcept {
+    TlsSession ssl(SSL_new(_ctx.get()));
+    if (!ssl || SSL_set_fd(ssl.get(), fd) != 1) {
+      return {};
+    }
+    SSL_set_accept_state(ssl.get());
+    return ssl;
+  }
+
+  /**
+   * @brief Moves a handshake forward on a non-blocking socket, as far as the
+   * socket allows.
+   * @param ssl The session.
+   * @return Where the handshake stands.
+   */
+  [[nodiscard]] static Handshake Step(SSL *ssl) noexcept {
+    const int ret = SSL_do_handshake(ssl);
+    if (ret == 1) {
+      // Only sessions the kernel fully took over can use the plain paths
+      const bool offloaded = BIO_get_ktls_send(SSL_get_wbio(ssl)) && BIO_get_ktls_recv(SSL_get_rbio(ssl));
+      return offloaded ? Handshake::Done : Handshake::Failed;
+    }
+    switch (SSL_get_error(ssl, ret)) {
+      case SSL_ERROR_WANT_READ:
+        return Handshake::WantRead;
+      case SSL_ERROR_WANT_WRITE:
+        return Handshake::WantWrite;
+      default:
+        ERR_clear_error();
+        return Handshake::Failed;
+    }
+  }
+
+ private:
+  /// @brief Frees an OpenSSL context.
+  struct ContextDeleter {
+    void operator()(SSL_CTX *ctx) const noexcept { SSL_CTX_free(ctx); }
+  };
+
+  /// @brief The OpenSSL context.
+  std::unique_ptr<SSL_CTX, ContextDeleter> _ctx;
+};
+
+}  // namespace tcp
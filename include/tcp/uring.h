@@ -0,0 +1,306 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+
+#include "utils.h"
+
+namespace tcp {
+
+/**
+ * @brief An io_uring instance with one group of provided receive buffers,
+ * driven through the raw system calls.
+ *
+ * Submissions are only handed to the kernel by Enter, so everything queued
+ * while handling a batch of completions goes out in one system call. Meant
+ * to be used by a single thread, which must also be the one creating it.
+ */
+class Uring {
+ public:
+  /// @brief Group id of the provided receive buffers.
+  static constexpr std::uint16_t kBufferGroup = 0;
+
+  /// @brief Largest number of receive buffers a group can hold.
+  static constexpr std::size_t kMaxBuffers = 32768;
+
+  /**
+   * @brief Creates a new io_uring instance and registers its receive
+   * buffers.
+   * @param entries The minimum number of submission queue entries.
+   * @param num_buffers The minimum number of receive buffers, rounded up to
+   * a power of two and capped at kMaxBuffers.
+   * @param buf_size The size of every receive buffer.
+   */
+  [[nodiscard]] Uring(unsigned entries, std::size_t num_buffers, std::size_t buf_size)
+      : _buf_size(buf_size), _num_buffers(std::bit_ceil(std::clamp<std::size_t>(num_buffers, 1, kMaxBuffers))) {
+    // Let the kernel run completion work only when the ring is waited on,
+    // falling back to the defaults on kernels without these flags
+    io_uring_params params{};
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                   IORING_SETUP_DEFER_TASKRUN;
+    _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (_fd == -1 && errno == EINVAL) {
+      params = {};
+      _fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    }
+    if (_fd == -1) {
+      throw Error("Failed to create io_uring instance.", Error::Kind::UringSetup);
+    }
+
+    try {
+      MapRings(params);
+      RegisterBuffers();
+    } catch (const Error &) {
+      Unmap();
+      close(_fd);
+      throw;
+    }
+  }
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  /**
+   * @brief Closes the instance, cancelling whatever is still in flight.
+   */
+  ~Uring() noexcept {
+    close(_fd);
+    Unmap();
+  }
+
+  /**
+   * @brief Returns a cleared submission queue entry to fill in, handing the
+   * queued ones to the kernel first if the queue is full.
+   * @return The entry, submitted by the next Enter.
+   */
+  [[nodiscard]] io_uring_sqe *GetSqe() {
+    if (_sq_tail_local - std::atomic_ref(*_sq_head).load(std::memory_order_acquire) == _sq_entries) {
+      Enter(0);
+    }
+    io_uring_sqe *sqe = &_sqes[_sq_tail_local & _sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++_sq_tail_local;
+    return sqe;
+  }
+
+  /**
+   * @brief Hands the queued submissions to the kernel, and waits for
+   * completions.
+   * @param min_complete The number of completions to wait for.
+   */
+  void Enter(unsigned min_complete) {
+    std::atomic_ref(*_sq_tail).store(_sq_tail_local, std::memory_order_release);
+    const unsigned to_submit = _sq_tail_local - std::atomic_ref(*_sq_head).load(std::memory_order_acquire);
+    const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (syscall(__NR_io_uring_enter, _fd, to_submit, min_complete, flags, nullptr, 0) == -1 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      throw Error("Failed to enter io_uring instance.", Error::Kind::UringEnter);
+    }
+  }
+
+  /**
+   * @brief Handles the completions posted so far, oldest first.
+   * @param f Called with every completion, may queue new submissions.
+   */
+  template <typename F>
+  void ForEachCompletion(F &&f) {
+    unsigned head = *_cq_head;
+    const unsigned tail = std::atomic_ref(*_cq_tail).load(std::memory_order_acquire);
+    for (; head != tail; ++head) {
+      f(static_cast<const io_uring_cqe &>(_cqes[head & _cq_mask]));
+    }
+    std::atomic_ref(*_cq_head).store(head, std::memory_order_release);
+    PublishBuffers();
+  }
+
+  /**
+   * @brief Returns the bytes a completion received into a provided buffer.
+   * @param bid The buffer id of the completion.
+   * @param len The number of bytes received.
+   * @return The bytes, valid until the buffer is recycled.
+   */
+  [[nodiscard]] std::span<const std::byte> Buffer(std::uint16_t bid, std::size_t len) const noexcept {
+    return {_buffers.get() + static_cast<std::size_t>(bid) * _buf_size, len};
+  }
+
+  /**
+   * @brief Gives a provided buffer back to the kernel. Recycled buffers are
+   * published once the current batch of completions is handled.
+   * @param bid The buffer id.
+   */
+  void RecycleBuffer(std::uint16_t bid) noexcept {
+    io_uring_buf &buf = _buf_ring[_buf_tail_local & (_num_buffers - 1)];
+    buf.addr = reinterpret_cast<std::uint64_t>(_buffers.get() + static_cast<std::size_t>(bid) * _buf_size);
+    buf.len = static_cast<std::uint32_t>(_buf_size);
+    buf.bid = bid;
+    ++_buf_tail_local;
+  }
+
+ private:
+  /**
+   * @brief Maps the submission and completion queues.
+   * @param params The parameters the kernel returned.
+   */
+  void MapRings(const io_uring_params &params) {
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+      _sq_size = _cq_size = _sq_size > _cq_size ? _sq_size : _cq_size;
+    }
+
+    _sq = Map(_sq_size, IORING_OFF_SQ_RING);
+    _cq = (params.features & IORING_FEAT_SINGLE_MMAP) != 0 ? _sq : Map(_cq_size, IORING_OFF_CQ_RING);
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sqes = static_cast<io_uring_sqe *>(Map(_sqes_size, IORING_OFF_SQES));
+
+    auto *sq = static_cast<std::byte *>(_sq);
+    _sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sq_entries = params.sq_entries;
+    _sq_tail_local = *_sq_tail;
+
+    // Entries are always used in order, so the indirection array is the
+    // identity
+    auto *sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; ++i) {
+      sq_array[i] = i;
+    }
+
+    auto *cq = static_cast<std::byte *>(_cq);
+    _cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    _cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  }
+
+  /**
+   * @brief Allocates the receive buffers and registers them with the kernel.
+   */
+  void RegisterBuffers() {
+    _buffers = std::make_unique_for_overwrite<std::byte[]>(_num_buffers * _buf_size);
+    _buf_ring_size = _num_buffers * sizeof(io_uring_buf);
+    void *ring = mmap(nullptr, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED) {
+      throw Error("Failed to allocate io_uring buffer ring.", Error::Kind::UringSetup);
+    }
+    _buf_ring = static_cast<io_uring_buf *>(ring);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<std::uint64_t>(ring);
+    reg.ring_entries = static_cast<std::uint32_t>(_num_buffers);
+    reg.bgid = kBufferGroup;
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+      throw Error("Failed to register io_uring buffer ring.", Error::Kind::UringSetup);
+    }
+
+    for (std::size_t bid = 0; bid < _num_buffers; ++bid) {
+      RecycleBuffer(static_cast<std::uint16_t>(bid));
+    }
+    PublishBuffers();
+  }
+
+  /**
+   * @brief Makes the recycled buffers visible to the kernel. The tail
+   * overlays the reserved field of the first entry.
+   */
+  void PublishBuffers() noexcept {
+    std::atomic_ref(_buf_ring[0].resv).store(_buf_tail_local, std::memory_order_release);
+  }
+
+  /**
+   * @brief Maps a region of the instance.
+   * @param size The size of the region.
+   * @param offset The offset telling which region to map.
+   * @return The mapping.
+   */
+  [[nodiscard]] void *Map(std::size_t size, off_t offset) const {
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, offset);
+    if (addr == MAP_FAILED) {
+      throw Error("Failed to map io_uring queues.", Error::Kind::UringSetup);
+    }
+    return addr;
+  }
+
+  /**
+   * @brief Unmaps whatever was mapped.
+   */
+  void Unmap() noexcept {
+    if (_buf_ring != nullptr) {
+      munmap(_buf_ring, _buf_ring_size);
+    }
+    if (_sqes != nullptr) {
+      munmap(_sqes, _sqes_size);
+    }
+    if (_cq != nullptr && _cq != _sq) {
+      munmap(_cq, _cq_size);
+    }
+    if (_sq != nullptr) {
+      munmap(_sq, _sq_size);
+    }
+  }
+
+  /// @brief The instance's file descriptor.
+  int _fd{-1};
+
+  /// @brief The submission queue mapping.
+  void *_sq{nullptr};
+  /// @brief The size of the submission queue mapping.
+  std::size_t _sq_size{0};
+  /// @brief The completion queue mapping, the same as the submission one on
+  /// kernels mapping both at once.
+  void *_cq{nullptr};
+  /// @brief The size of the completion queue mapping.
+  std::size_t _cq_size{0};
+  /// @brief The submission queue entries.
+  io_uring_sqe *_sqes{nullptr};
+  /// @brief The size of the submission queue entries mapping.
+  std::size_t _sqes_size{0};
+
+  /// @brief Next submission the kernel takes, written by the kernel.
+  unsigned *_sq_head{nullptr};
+  /// @brief Submissions handed to the kernel so far.
+  unsigned *_sq_tail{nullptr};
+  /// @brief Submissions queued so far, handed to the kernel on Enter.
+  unsigned _sq_tail_local{0};
+  /// @brief Mask turning a position into a submission entry index.
+  unsigned _sq_mask{0};
+  /// @brief The number of submission entries.
+  unsigned _sq_entries{0};
+
+  /// @brief Next completion to handle.
+  unsigned *_cq_head{nullptr};
+  /// @brief Completions posted so far, written by the kernel.
+  unsigned *_cq_tail{nullptr};
+  /// @brief Mask turning a position into a completion index.
+  unsigned _cq_mask{0};
+  /// @brief The completions.
+  io_uring_cqe *_cqes{nullptr};
+
+  /// @brief The size of every receive buffer.
+  std::size_t _buf_size;
+  /// @brief The number of receive buffers.
+  std::size_t _num_buffers;
+  /// @brief The receive buffers, back to back.
+  std::unique_ptr<std::byte[]> _buffers;
+  /// @brief The ring handing the receive buffers to the kernel.
+  io_uring_buf *_buf_ring{nullptr};
+  /// @brief The size of the buffer ring mapping.
+  std::size_t _buf_ring_size{0};
+  /// @brief Buffers handed to the kernel so far.
+  std::uint16_t _buf_tail_local{0};
+};
+
+}  // namespace tcp
@@ -0,0 +1,991 @@
+#pragma once
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "address.h"
+#include "buffer_pool.h"
+#include "connection.h"
+#include "framing.h"
+#include "handler.h"
+#include "metrics.h"
+#include "options.h"
+#include "output.h"
+#include "uring.h"
+#include "utils.h"
+#include "write_queue.h"
+
+namespace tcp {
+
+/**
+ * @brief TCP server running on io_uring instead of epoll, with the same
+ * handlers, framing policies and interface as Server.
+ *
+ * Every thread runs its own io_uring instance and listening socket, and
+ * serves the connections it accepted, handler calls included, like Server
+ * with Options::reactor_per_thread. Connections are accepted by a multishot
+ * accept and read by multishot receives into buffers provided to the kernel,
+ * and everything submitted while handling a batch of completions goes out in
+ * a single system call. The thread pool and edge triggered options do not
+ * apply, nor do the latency histograms of the metrics.
+ * @tparam Handler The handler type.
+ * @tparam Framing The framing policy.
+ */
+template <typename Handler, typename Framing = RawFraming>
+class UringServer {
+  static_assert(ConnectionHandler<Handler>, "Handler must provide OnRead with span or vector buffers");
+  static_assert(FramingPolicy<Framing>, "Framing must provide FrameSize and Payload");
+  static_assert(!AsyncReadHandler<Handler>, "Coroutine handlers need the epoll backend");
+
+ private:
+  /// @brief Kind of operation a completion belongs to, kept in the low bits
+  /// of its user data.
+  enum class Op : std::uint64_t {
+    /// @brief The multishot accept of the listening socket.
+    Accept,
+    /// @brief The multishot receive of a connection.
+    Recv,
+    /// @brief A send of a connection.
+    Send,
+    /// @brief The cancellation of the receive or the send of a connection.
+    Cancel,
+    /// @brief An operation of the loop itself, told apart by Control.
+    Control,
+  };
+
+  /// @brief Mask of the operation kind in the user data.
+  static constexpr std::uint64_t kOpMask = 7;
+
+  /// @brief Operation of the loop itself, kept above the operation kind in
+  /// the user data.
+  enum class Control : std::uint64_t {
+    /// @brief The poll of the event descriptor, ready once the server stops.
+    Wake,
+    /// @brief The timer closing the connections still draining.
+    DrainTimeout,
+    /// @brief The cancellation of a multishot accept.
+    CancelAccept,
+  };
+
+  /// @brief The handler's per-connection data.
+  using Session = typename SessionOf<Handler>::type;
+
+  /// @brief State of an open connection, only ever touched by the thread
+  /// serving it. The handler only sees the Connection part.
+  struct ConnectionState : Connection<Session> {
+    /**
+     * @brief Creates the state of a new connection.
+     * @param client_fd The client socket.
+     * @param client_addr The client address.
+     */
+    ConnectionState(const int client_fd, const Address &client_addr) noexcept
+        : Connection<Session>(client_fd, client_addr) {}
+
+    /// @brief Responses not sent yet, the ones in flight included.
+    WriteQueue out;
+    /// @brief The chunks of the send in flight.
+    std::array<iovec, WriteQueue::kMaxIov> iov{};
+    /// @brief The message of the send in flight.
+    msghdr msg{};
+    /// @brief The start of a frame whose rest was not received yet.
+    BufferPool::Buffer partial;
+    /// @brief The previous open connection of the loop.
+    ConnectionState *prev_open{nullptr};
+    /// @brief The next open connection of the loop.
+    ConnectionState *next_open{nullptr};
+    /// @brief Operations in flight and handlers running on the connection,
+    /// which is freed once it is closed and this drops to zero.
+    unsigned inflight{0};
+    /// @brief Whether the multishot receive is armed.
+    bool receiving{false};
+    /// @brief Whether a send is in flight.
+    bool sending{false};
+    /// @brief Whether reading is paused until the responses drain.
+    bool read_paused{false};
+    /// @brief Whether to close the connection once the responses drain.
+    bool closing{false};
+    /// @brief Whether the connection was closed.
+    bool closed{false};
+    /// @brief Whether the connection is closed because the server stops.
+    bool stopping{false};
+  };
+  static_assert(alignof(ConnectionState) > kOpMask, "Connections must leave room for the operation kind");
+
+  /// @brief An event loop with its own io_uring instance and listening
+  /// sockets.
+  struct Loop {
+    /// @brief The io_uring instance.
+    Uring &ring;
+    /// @brief The handler of the thread running the loop.
+    Handler &handler;
+    /// @brief The listening sockets, one per listener of the server, -1 once
+    /// closed.
+    std::vector<int> &server_fds;
+    /// @brief The event descriptor the server writes to once it stops.
+    int event_fd;
+    /// @brief The metrics of the loop.
+    ThreadMetrics &metrics;
+    /// @brief The open connections, linked through
+    /// ConnectionState::next_open.
+    ConnectionState *open{nullptr};
+    /// @brief The connections not freed yet, open or waiting for their
+    /// operations in flight.
+    std::size_t live{0};
+    /// @brief The multishot accepts armed.
+    std::size_t accepting{0};
+    /// @brief Whether the loop is shutting down.
+    bool draining{false};
+    /// @brief The drain timeout, read by the kernel once the timer is
+    /// submitted.
+    __kernel_timespec drain_timeout{};
+  };
+
+  /// @brief Whether the handler reads spans of exactly the bytes received,
+  /// rather than null terminated receive buffers.
+  static constexpr bool kSpanRead = SpanReadHandler<Handler>;
+
+  /// @brief Whether the bytes received are reassembled into frames.
+  static constexpr bool kFramed = !std::is_same_v<Framing, RawFraming>;
+  static_assert(!kFramed || kSpanRead, "Framed servers need a handler reading spans");
+
+ public:
+  /**
+   * @brief Creates a new server listening on a port of every IPv4 interface.
+   * @param port The port to listen on.
+   * @param threads The number of threads to use, each with its own io_uring
+   * instance.
+   * @param buf_size The size of the receive buffers.
+   * @param max_events Checked like Server does, the queues are sized by
+   * Options::uring_entries.
+   * @param options Optional server settings.
+   */
+  [[nodiscard]] UringServer(std::uint16_t port, std::size_t threads,
+                            std::size_t buf_size, int max_events,
+                            const Options &options = {})
+      : UringServer(std::vector<Address>{Address::Ipv4(port)}, threads, buf_size, max_events, options) {}
+
+  /**
+   * @brief Creates a new server listening on several addresses, of any
+   * family. Every thread accepts on all of them.
+   * @param listeners The addresses to listen on.
+   * @param threads The number of threads to use, each with its own io_uring
+   * instance.
+   * @param buf_size The size of the receive buffers.
+   * @param max_events Checked like Server does, the queues are sized by
+   * Options::uring_entries.
+   * @param options Optional server settings.
+   */
+  [[nodiscard]] UringServer(const std::vector<Address> &listeners, std::size_t threads,
+                            std::size_t buf_size, int max_events,
+                            const Options &options = {})
+      : _buf_size(buf_size), _options(options), _recv_buffers(buf_size), _send_buffers(buf_size),
+        _loop_metrics(std::make_unique<ThreadMetrics[]>(threads)), _num_loops(threads) {
+    // Check if the max_events is valid.
+    if (max_events <= 0) {
+      throw Error("Invalid max events.", Error::Kind::UringSetup);
+    }
+
+    // Check if there is anything to listen on
+    if (listeners.empty()) {
+      throw Error("No address to listen on.", Error::Kind::SocketBinding);
+    }
+
+    // Check if TLS was asked for, which this backend cannot terminate
+    if (!_options.tls_cert_file.empty()) {
+      throw Error("TLS is only supported by the epoll backend.", Error::Kind::Tls);
+    }
+
+    // Check if there is at least one thread to run the event loops on
+    if (threads == 0) {
+      throw Error("Invalid number of threads.", Error::Kind::UringSetup);
+    }
+
+    // Check if the event loops can run where they are asked to
+    for (const int cpu : _options.reactor_cpus) {
+      if (!IsCpuAvailable(cpu)) {
+        throw Error("Invalid reactor CPU.", Error::Kind::ThreadAffinity);
+      }
+    }
+
+    // Open the listening sockets and event descriptor of every thread,
+    // closing the ones already open if any of them fails. IP sockets are
+    // opened per thread with SO_REUSEPORT, Unix domain ones are shared since
+    // they cannot be bound twice
+    try {
+      for (std::size_t i = 0; i < threads; ++i) {
+        const int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd == -1) {
+          throw Error("Failed to create event descriptor.", Error::Kind::UringSetup);
+        }
+        _event_fds.push_back(event_fd);
+
+        std::vector<int> &server_fds = _server_fds.emplace_back();
+        for (std::size_t j = 0; j < listeners.size(); ++j) {
+          if (listeners[j].Family() == AF_UNIX && i > 0) {
+            const int server_fd = fcntl(_server_fds.front()[j], F_DUPFD_CLOEXEC, 0);
+            if (server_fd == -1) {
+              throw Error("Failed to share server socket.", Error::Kind::SocketCreation);
+            }
+            server_fds.push_back(server_fd);
+            continue;
+          }
+          server_fds.push_back(OpenServerSocket(listeners[j], threads > 1, _options.v6_only));
+          ApplyListenerOptions(server_fds.back(), listeners[j].Family(), _options.sockets);
+
+          // Ask for the connections whose packets are processed on the
+          // loop's CPU
+          if (const int cpu = LoopCpu(i);
+              _options.incoming_cpu && cpu != -1 &&
+              setsockopt(server_fds.back(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) == -1) {
+            throw Error("Failed to set socket options.", Error::Kind::SocketCreation);
+          }
+        }
+      }
+    } catch (const Error &) {
+      CloseServerSockets();
+      throw;
+    }
+  }
+
+  /**
+   * @brief Closes the sever's sockets.
+   */
+  ~UringServer() noexcept { CloseServerSockets(); }
+
+  /**
+   * @brief Runs the server with a handler shared by all threads.
+   *
+   * Every event loop but the first one gets its own thread, the first one
+   * runs on the calling thread. An error escaping a thread other than the
+   * calling one terminates the process, one on the calling thread stops the
+   * other loops before Run throws it. Returns once the server was stopped, a
+   * stopped server cannot run again.
+   * @param handler The handler for the server.
+   */
+  void Run(Handler &handler) {
+    RunLoops([&handler](std::size_t) -> Handler & { return handler; });
+  }
+
+  /**
+   * @brief Runs the server with one handler per thread, so handlers can keep
+   * thread-local state without locking. Returns once the server was stopped.
+   * @param factory Creates a handler each time it is called.
+   */
+  template <typename Factory>
+    requires(!std::is_same_v<std::remove_cvref_t<Factory>, Handler> && std::is_invocable_r_v<Handler, Factory &>)
+  void Run(Factory &&factory) {
+    _handlers.reserve(_server_fds.size());
+    for (std::size_t i = 0; i < _server_fds.size(); ++i) {
+      _handlers.emplace_back(new Handler(factory()));
+    }
+
+    RunLoops([this](std::size_t i) -> Handler & { return *_handlers[i]; });
+  }
+
+  /**
+   * @brief Stops the server gracefully, from any thread, a signal handler
+   * included.
+   *
+   * The loops stop accepting and reading, close the idle connections and the
+   * others once their responses drained, closing the ones still writing after
+   * Options::drain_timeout. The handler gets an OnClose for every connection
+   * closed on the way. Run returns once every connection is gone.
+   */
+  void Stop() noexcept {
+    for (const int event_fd : _event_fds) {
+      eventfd_write(event_fd, 1);
+    }
+  }
+
+  /**
+   * @brief Adds up the metrics of every loop, from any thread while the
+   * server runs. Only the counters are kept, the latency histograms stay
+   * empty on this backend.
+   * @return The metrics so far.
+   */
+  [[nodiscard]] MetricsSnapshot Metrics() {
+    MetricsSnapshot snapshot;
+    for (std::size_t i = 0; i < _num_loops; ++i) {
+      _loop_metrics[i].MergeInto(snapshot);
+    }
+    return snapshot;
+  }
+
+ private:
+  /**
+   * @brief Starts listening and runs the event loops.
+   * @param loop_handler Returns the handler of each thread.
+   */
+  template <typename F>
+  void RunLoops(F &&loop_handler) {
+    // Listen for incoming connections
+    for (const std::vector<int> &server_fds : _server_fds) {
+      for (const int server_fd : server_fds) {
+        if (listen(server_fd, _options.listen_backlog) == -1) {
+          throw Error("Failed to listen on server socket.", Error::Kind::SocketListening);
+        }
+      }
+    }
+
+    std::vector<std::thread> loop_threads;
+    try {
+      // Start the other event loops on their own threads
+      for (std::size_t i = 1; i < _server_fds.size(); ++i) {
+        loop_threads.emplace_back([this, &handler = loop_handler(i), i] {
+          PinLoop(i);
+          RunLoop(i, handler);
+        });
+      }
+
+      // The first event loop runs on the calling thread
+      PinLoop(0);
+      RunLoop(0, loop_handler(0));
+    } catch (...) {
+      // Wind the loops already started down before passing the error on
+      Stop();
+      for (std::thread &thread : loop_threads) {
+        thread.join();
+      }
+      throw;
+    }
+    for (std::thread &thread : loop_threads) {
+      thread.join();
+    }
+  }
+
+  /**
+   * @brief Returns the CPU an event loop is pinned to, from
+   * Options::reactor_cpus.
+   * @param index The index of the loop.
+   * @return The CPU, -1 if the loop is not pinned.
+   */
+  [[nodiscard]] int LoopCpu(const std::size_t index) const noexcept {
+    const std::vector<int> &cpus = _options.reactor_cpus;
+    return cpus.empty() ? -1 : cpus[index % cpus.size()];
+  }
+
+  /**
+   * @brief Pins the calling thread to the CPU of an event loop, if it has
+   * one, before its ring and buffers are allocated.
+   * @param index The index of the loop.
+   */
+  void PinLoop(const std::size_t index) const {
+    if (const int cpu = LoopCpu(index); cpu != -1 && !PinThread(cpu)) {
+      throw Error("Failed to pin an event loop thread.", Error::Kind::ThreadAffinity);
+    }
+  }
+
+  /**
+   * @brief Closes the listening sockets and event descriptors.
+   */
+  void CloseServerSockets() noexcept {
+    for (const std::vector<int> &server_fds : _server_fds) {
+      for (const int server_fd : server_fds) {
+        if (server_fd != -1) {
+          close(server_fd);
+        }
+      }
+    }
+    _server_fds.clear();
+    for (const int event_fd : _event_fds) {
+      close(event_fd);
+    }
+    _event_fds.clear();
+  }
+
+  /**
+   * @brief Runs an event loop until the server stopped and its connections
+   * are gone.
+   * @param index The index of the loop.
+   * @param handler The handler of the calling thread.
+   */
+  void RunLoop(const std::size_t index, Handler &handler) {
+    // The instance is created by the only thread submitting to it
+    Uring ring(_options.uring_entries, _options.uring_recv_buffers, _buf_size);
+    Loop loop{.ring = ring,
+              .handler = handler,
+              .server_fds = _server_fds[index],
+              .event_fd = _event_fds[index],
+              .metrics = _loop_metrics[index]};
+    for (std::size_t i = 0; i < loop.server_fds.size(); ++i) {
+      PrepareAccept(loop, i);
+    }
+    PrepareWake(loop);
+
+    // Event Loop, until every connection and accept is gone after a stop
+    while (!loop.draining || loop.live > 0 || loop.accepting > 0) {
+      // Submit what the previous batch queued, and wait for completions
+      ring.Enter(1);
+
+      // Process each completion
+      ring.ForEachCompletion([this, &loop](const io_uring_cqe &cqe) {
+        auto *conn = reinterpret_cast<ConnectionState *>(cqe.user_data & ~kOpMask);
+        switch (static_cast<Op>(cqe.user_data & kOpMask)) {
+          case Op::Accept:
+            return HandleAccept(loop, cqe);
+          case Op::Recv:
+            return HandleRecv(loop, conn, cqe);
+          case Op::Send:
+            return HandleSend(loop, conn, cqe);
+          case Op::Cancel:
+            return Release(loop, conn);
+          case Op::Control:
+            return HandleControl(loop, cqe);
+        }
+      });
+    }
+  }
+
+  /**
+   * @brief Handles a completion of the loop itself.
+   * @param loop The event loop.
+   * @param cqe The completion.
+   */
+  void HandleControl(Loop &loop, const io_uring_cqe &cqe) {
+    switch (static_cast<Control>(cqe.user_data / (kOpMask + 1))) {
+      case Control::Wake:
+        return Drain(loop);
+      case Control::DrainTimeout:
+        // Close the connections still writing their responses
+        for (ConnectionState *conn = loop.open; conn != nullptr;) {
+          ConnectionState *next = conn->next_open;
+          Close(loop, conn);
+          if constexpr (CloseHandler<Handler>) {
+            loop.handler.OnClose(*conn);
+          }
+          conn = next;
+        }
+        return;
+      case Control::CancelAccept:
+        return;  // The accept completes on its own
+    }
+  }
+
+  /**
+   * @brief Starts shutting a loop down: stops accepting and reading, and
+   * closes every connection once its responses are out or the drain timeout
+   * expired.
+   * @param loop The event loop.
+   */
+  void Drain(Loop &loop) {
+    loop.draining = true;
+
+    // Stop accepting. The accepts keep the sockets listening until they are
+    // cancelled
+    for (std::size_t i = 0; i < loop.server_fds.size(); ++i) {
+      io_uring_sqe *sqe = loop.ring.GetSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = i * (kOpMask + 1) | static_cast<std::uint64_t>(Op::Accept);
+      sqe->user_data = ControlTag(Control::CancelAccept);
+      close(std::exchange(loop.server_fds[i], -1));
+    }
+
+    // Close the connections still draining once the timeout expires
+    const auto timeout = _options.drain_timeout;
+    loop.drain_timeout.tv_sec = timeout.count() / 1000;
+    loop.drain_timeout.tv_nsec = (timeout.count() % 1000) * 1000000;
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&loop.drain_timeout);
+    sqe->len = 1;
+    sqe->user_data = ControlTag(Control::DrainTimeout);
+
+    // Stop reading, closing the connections once their responses are out
+    for (ConnectionState *conn = loop.open; conn != nullptr;) {
+      ConnectionState *next = conn->next_open;
+      conn->stopping = true;
+      conn->closing = true;
+      conn->read_paused = true;
+      if (conn->receiving) {
+        PrepareCancel(loop, conn, Op::Recv);
+      }
+      Flush(loop, conn);
+      conn = next;
+    }
+  }
+
+  /**
+   * @brief Handles an accepted connection, or a failed accept.
+   * @param loop The event loop.
+   * @param cqe The completion.
+   */
+  void HandleAccept(Loop &loop, const io_uring_cqe &cqe) {
+    // The multishot accept stops on errors, start it again unless it was
+    // cancelled by a stop
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+      --loop.accepting;
+      if (!loop.draining) {
+        PrepareAccept(loop, (cqe.user_data & ~kOpMask) / (kOpMask + 1));
+      }
+    }
+
+    // Check if the connection was accepted successfully
+    if (cqe.res < 0) {
+      return;  // Out of descriptors, or the client went away
+    } else if (loop.draining) {
+      close(cqe.res);
+      return;  // Accepted before the stop was seen
+    }
+
+    // Multishot accepts share one address buffer, so ask for it instead
+    const int client_fd = cqe.res;
+    Address client_addr;
+    try {
+      client_addr = GetClientAddress(client_fd);
+    } catch (const Error &) {
+      close(client_fd);
+      return;  // Ignore the connection
+    }
+
+    // Handle the new connection, then start reading from it
+    auto *conn = new ConnectionState(client_fd, client_addr);
+    conn->inflight = 1;
+    conn->next_open = loop.open;
+    if (loop.open != nullptr) {
+      loop.open->prev_open = conn;
+    }
+    loop.open = conn;
+    ++loop.live;
+    loop.metrics.accepts.Add();
+    HandleNew(loop, conn);
+    if (!conn->closed && !conn->closing) {
+      PrepareRecv(loop, conn);
+    }
+    Release(loop, conn);
+  }
+
+  /**
+   * @brief Handles bytes received from a connection, or the end of its
+   * receive.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param cqe The completion.
+   */
+  void HandleRecv(Loop &loop, ConnectionState *conn, const io_uring_cqe &cqe) {
+    if (cqe.res > 0) {
+      // Hand the bytes over, then give their buffer back to the kernel
+      const auto bid = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+      loop.metrics.reads.Add();
+      loop.metrics.bytes_read.Add(static_cast<std::size_t>(cqe.res));
+      if (_options.sockets.quick_ack && conn->addr.Family() != AF_UNIX) {
+        RearmQuickAck(conn->fd);
+      }
+      if (!conn->closed && !conn->closing) {
+        HandleRead(loop, conn, loop.ring.Buffer(bid, static_cast<std::size_t>(cqe.res)));
+      }
+      loop.ring.RecycleBuffer(bid);
+    } else if (cqe.res == 0) {
+      // The client closed the connection
+      if (!conn->closed) {
+        Close(loop, conn);
+        if constexpr (CloseHandler<Handler>) {
+          loop.handler.OnClose(*conn);
+        }
+      }
+    } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+      Fail(loop, conn, {"Failed to read from a client.", Error::Kind::Read});
+    }
+
+    // The multishot receive stops when it runs out of buffers or is
+    // cancelled, start it again unless reading is paused
+    if ((cqe.flags & IORING_CQE_F_MORE) != 0) {
+      return;
+    }
+    conn->receiving = false;
+    if (!conn->closed && !conn->read_paused) {
+      PrepareRecv(loop, conn);
+    }
+    Release(loop, conn);
+  }
+
+  /**
+   * @brief Handles the end of a send, and sends whatever is left.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param cqe The completion.
+   */
+  void HandleSend(Loop &loop, ConnectionState *conn, const io_uring_cqe &cqe) {
+    conn->sending = false;
+    if (!conn->closed) {
+      if (cqe.res >= 0) {
+        loop.metrics.bytes_written.Add(static_cast<std::size_t>(cqe.res));
+        conn->out.Consume(static_cast<std::size_t>(cqe.res));
+        Flush(loop, conn);
+      } else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+        Flush(loop, conn);
+      } else {
+        Fail(loop, conn, {"Failed to write response.", Error::Kind::Write});
+      }
+    }
+    Release(loop, conn);
+  }
+
+  /**
+   * @brief Lets the handler welcome a new connection, if it has OnNew,
+   * without setting up an output if it never writes on open.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  void HandleNew([[maybe_unused]] Loop &loop, [[maybe_unused]] ConnectionState *conn) {
+    if constexpr (SilentNewHandler<Handler>) {
+      if (!loop.handler.OnNew(*conn)) {
+        Close(loop, conn);
+      }
+    } else if constexpr (NewHandler<Handler>) {
+      Output out(_send_buffers);
+      bool keep_alive{};
+      if constexpr (SpanNewHandler<Handler>) {
+        keep_alive = loop.handler.OnNew(*conn, out);
+      } else {
+        keep_alive = loop.handler.OnNew(*conn, out.Bytes());
+      }
+      QueueResponse(loop, conn, out, keep_alive);
+    }
+  }
+
+  /**
+   * @brief Hands bytes received to the handler, one frame at a time.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param data The bytes received, valid until the handler returns.
+   */
+  void HandleRead(Loop &loop, ConnectionState *conn, std::span<const std::byte> data) {
+    Output out(_send_buffers);
+    bool keep_alive = true;
+
+    if constexpr (!kSpanRead) {
+      // Handlers reading vectors get a null terminated receive buffer
+      BufferPool::Buffer in_buf = _recv_buffers.AcquireSized();
+      std::copy(data.begin(), data.end(), in_buf->begin());
+      if (data.size() < in_buf->size()) {
+        (*in_buf)[data.size()] = std::byte{0};
+      }
+      keep_alive = loop.handler.OnRead(*conn, *in_buf, out.Bytes());
+    } else if constexpr (!kFramed) {
+      // Hand the provided buffer over as is
+      keep_alive = loop.handler.OnRead(*conn, data, out);
+    } else {
+      // Join the bytes to the start of a frame received earlier, if any
+      BufferPool::Buffer joined = std::move(conn->partial);
+      std::span<const std::byte> rest = data;
+      if (joined) {
+        joined->insert(joined->end(), data.begin(), data.end());
+        rest = *joined;
+      }
+
+      // Hand over the complete frames, stopping once the handler closes
+      while (keep_alive && !rest.empty()) {
+        const std::size_t size = Framing::FrameSize(rest);
+        if (size == kInvalidFrame) {
+          return Fail(loop, conn, {"Received a malformed frame.", Error::Kind::Read});
+        } else if (size == kIncompleteFrame) {
+          break;
+        }
+        keep_alive = loop.handler.OnRead(*conn, Framing::Payload(rest.first(size)), out);
+        rest = rest.subspan(size);
+      }
+
+      // Keep the incomplete frame until the rest of it is received
+      if (keep_alive && !rest.empty()) {
+        const std::size_t left = rest.size();
+        if (!joined) {
+          joined = _recv_buffers.AcquireEmpty();
+          joined->assign(rest.begin(), rest.end());
+        } else {
+          joined->erase(joined->begin(), joined->end() - static_cast<std::ptrdiff_t>(left));
+        }
+        conn->partial = std::move(joined);
+      }
+    }
+
+    QueueResponse(loop, conn, out, keep_alive);
+  }
+
+  /**
+   * @brief Queues a response behind the pending ones and sends it once the
+   * sends before it are done.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param out The response.
+   * @param keep_alive Whether the handler wants the connection to stay open.
+   */
+  void QueueResponse(Loop &loop, ConnectionState *conn, Output &out, const bool keep_alive) {
+    if (conn->closed) {
+      return;
+    }
+
+    // Keep the response in order behind whatever is pending
+    try {
+      out.MoveTo(conn->out);
+    } catch (const std::bad_alloc &) {
+      return Fail(loop, conn, {"Failed to queue response.", Error::Kind::Write});
+    }
+
+    // Close the connection if the handler has requested it, once the
+    // response is out
+    if (!keep_alive) {
+      conn->closing = true;
+      conn->read_paused = true;
+      if (conn->receiving) {
+        PrepareCancel(loop, conn, Op::Recv);
+      }
+    }
+
+    Flush(loop, conn);
+  }
+
+  /**
+   * @brief Carries on after the write queue of a connection changed. Sends
+   * what is pending, applies the watermarks, and closes the connection if it
+   * was only waiting for its responses to go out.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  void Flush(Loop &loop, ConnectionState *conn) {
+    // Check if the connection was only waiting for its responses to go out,
+    // reporting the ones closed by a stop
+    if (conn->closing && conn->out.empty()) {
+      Close(loop, conn);
+      if constexpr (CloseHandler<Handler>) {
+        if (conn->stopping) {
+          loop.handler.OnClose(*conn);
+        }
+      }
+      return;
+    }
+
+    // One send at a time, it takes everything pending up to kMaxIov chunks,
+    // or the next piece of a file read in their place
+    if (!conn->sending && !conn->out.empty()) {
+      if (!conn->out.LoadFile(_send_buffers)) {
+        return Fail(loop, conn, {"Failed to read a file response.", Error::Kind::Write});
+      }
+      PrepareSend(loop, conn);
+    }
+
+    // Stop reading from clients that do not drain their responses
+    if (conn->out.bytes() > _options.write_high_watermark && !conn->read_paused) {
+      conn->read_paused = true;
+      if (conn->receiving) {
+        PrepareCancel(loop, conn, Op::Recv);
+      }
+    } else if (conn->read_paused && !conn->closing && conn->out.bytes() <= _options.write_low_watermark) {
+      conn->read_paused = false;
+      if (!conn->receiving) {
+        PrepareRecv(loop, conn);
+      }
+    }
+  }
+
+  /**
+   * @brief Closes a connection. It is freed once everything in flight on it
+   * completed.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  static void Close(Loop &loop, ConnectionState *conn) {
+    if (conn->closed) {
+      return;
+    }
+    conn->closed = true;
+    if (conn->receiving) {
+      PrepareCancel(loop, conn, Op::Recv);
+    }
+    // A send to a client not reading would hold on to the socket forever
+    if (conn->sending) {
+      PrepareCancel(loop, conn, Op::Send);
+    }
+    close(conn->fd);
+    loop.metrics.closes.Add();
+
+    // Unlink it from the open connections
+    if (conn->prev_open != nullptr) {
+      conn->prev_open->next_open = conn->next_open;
+    } else {
+      loop.open = conn->next_open;
+    }
+    if (conn->next_open != nullptr) {
+      conn->next_open->prev_open = conn->prev_open;
+    }
+  }
+
+  /**
+   * @brief Closes a connection after an error, and reports the error.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param error The error.
+   */
+  static void Fail(Loop &loop, ConnectionState *conn, [[maybe_unused]] const Error &error) {
+    if (!conn->closed) {
+      Close(loop, conn);
+      loop.metrics.errors.Add();
+      if constexpr (ErrorHandler<Handler>) {
+        loop.handler.OnError(*conn, error);
+      }
+    }
+  }
+
+  /**
+   * @brief Drops a reference on a connection held by a completed operation,
+   * freeing it if it was closed and this was the last one.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  static void Release(Loop &loop, ConnectionState *conn) noexcept {
+    if (--conn->inflight == 0 && conn->closed) {
+      delete conn;
+      --loop.live;
+    }
+  }
+
+  /**
+   * @brief Tags a connection with the kind of an operation on it.
+   * @param conn The connection.
+   * @param op The kind of operation.
+   * @return The user data of the operation.
+   */
+  [[nodiscard]] static std::uint64_t Tag(ConnectionState *conn, const Op op) noexcept {
+    return reinterpret_cast<std::uint64_t>(conn) | static_cast<std::uint64_t>(op);
+  }
+
+  /**
+   * @brief Returns the user data of an operation of the loop itself.
+   * @param control The operation.
+   * @return The user data.
+   */
+  [[nodiscard]] static std::uint64_t ControlTag(const Control control) noexcept {
+    return static_cast<std::uint64_t>(control) * (kOpMask + 1) | static_cast<std::uint64_t>(Op::Control);
+  }
+
+  /**
+   * @brief Queues the multishot accept of a listening socket. Its index
+   * stands in the user data where connections are for the other operations.
+   * @param loop The event loop.
+   * @param index The index of the listening socket.
+   */
+  static void PrepareAccept(Loop &loop, const std::size_t index) {
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop.server_fds[index];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = index * (kOpMask + 1) | static_cast<std::uint64_t>(Op::Accept);
+    ++loop.accepting;
+  }
+
+  /**
+   * @brief Queues the poll of the event descriptor, which completes once the
+   * server stops.
+   * @param loop The event loop.
+   */
+  static void PrepareWake(Loop &loop) {
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = loop.event_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = ControlTag(Control::Wake);
+  }
+
+  /**
+   * @brief Queues the multishot receive of a connection, into the provided
+   * buffers.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  static void PrepareRecv(Loop &loop, ConnectionState *conn) {
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::kBufferGroup;
+    sqe->user_data = Tag(conn, Op::Recv);
+    conn->receiving = true;
+    ++conn->inflight;
+  }
+
+  /**
+   * @brief Queues a send of the oldest pending responses of a connection.
+   * @param loop The event loop.
+   * @param conn The connection.
+   */
+  static void PrepareSend(Loop &loop, ConnectionState *conn) {
+    conn->msg = {};
+    conn->msg.msg_iov = conn->iov.data();
+    conn->msg.msg_iovlen = conn->out.Gather(conn->iov);
+
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&conn->msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = Tag(conn, Op::Send);
+    conn->sending = true;
+    ++conn->inflight;
+  }
+
+  /**
+   * @brief Queues the cancellation of the receive or the send of a
+   * connection.
+   * @param loop The event loop.
+   * @param conn The connection.
+   * @param op The operation to cancel.
+   */
+  static void PrepareCancel(Loop &loop, ConnectionState *conn, const Op op) {
+    io_uring_sqe *sqe = loop.ring.GetSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = Tag(conn, op);
+    sqe->user_data = Tag(conn, Op::Cancel);
+    ++conn->inflight;
+  }
+
+  // -- Member Variables --
+  /// @brief The receive buffer size.
+  std::size_t _buf_size;
+
+  /// @brief Optional server settings.
+  Options _options;
+
+  /// @brief The listening sockets of every thread, one per listener.
+  std::vector<std::vector<int>> _server_fds;
+
+  /// @brief Recycled buffers for frames split across receives, and for
+  /// handlers reading vectors.
+  BufferPool _recv_buffers;
+  /// @brief Recycled send buffers.
+  BufferPool _send_buffers;
+
+  /// @brief One handler per thread, when running with a handler factory.
+  std::vector<std::unique_ptr<Handler>> _handlers;
+
+  /// @brief The event descriptor of every thread, written to once the
+  /// server stops.
+  std::vector<int> _event_fds;
+
+  /// @brief The metrics of every thread.
+  std::unique_ptr<ThreadMetrics[]> _loop_metrics;
+  /// @brief The number of threads.
+  std::size_t _num_loops;
+};
+
+}  // namespace tcp
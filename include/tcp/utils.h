@@ -1,6 +1,14 @@
 #pragma once
 
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
 
 namespace tcp {
 
@@ -27,6 +35,17 @@ class Error : public std::runtime_error {
     Read,
     /// @brief Error while writing to a connection.
     Write,
+    /// @brief Error while setting up an io_uring instance.
+    UringSetup,
+    /// @brief Error while submitting to or waiting on an io_uring instance.
+    UringEnter,
+    /// @brief Error while pinning a thread to a CPU.
+    ThreadAffinity,
+    /// @brief Error while handing the listening sockets over to a restarted
+    /// server.
+    Handoff,
+    /// @brief Error while setting up TLS, or shaking hands with a client.
+    Tls,
   };
 
   /**
@@ -49,29 +68,31 @@ class Error : public std::runtime_error {
 };
 
 /**
- * @brief Writes the given data to the given socket.
- * @param client_fd The client socket.
- * @param buf The buffer.
+ * @brief Checks whether the process may run threads on a CPU.
+ * @param cpu The CPU number.
+ * @return Whether the CPU exists and is in the process's affinity mask.
  */
-void Write(int client_fd, const std::vector<std::byte> &buf) {
-  if (!buf.empty()) {
-    if (write(client_fd, buf.data(), buf.size()) == -1) {
-      throw Error("Failed to write response.", Error::Kind::Write);
-    }
-  }
+[[nodiscard]] inline bool IsCpuAvailable(const int cpu) noexcept {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  return cpu >= 0 && cpu < CPU_SETSIZE && sched_getaffinity(0, sizeof(allowed), &allowed) == 0 &&
+         CPU_ISSET(cpu, &allowed);
 }
 
 /**
- * @brief Gets the client address.
- * @param client_fd The client socket.
- * @return
+ * @brief Pins the calling thread to a CPU. Memory it touches first is then
+ * allocated on that CPU's NUMA node by the kernel's default policy.
+ * @param cpu The CPU number.
+ * @return Whether the thread was pinned.
  */
-[[nodiscard]] sockaddr_in GetClientAddress(int client_fd) {
-  sockaddr_in client_addr{};
-  socklen_t client_addr_len = sizeof(client_addr);
-  if (getpeername(client_fd, reinterpret_cast<sockaddr *>(&client_addr), &client_addr_len) == -1) {
-    throw Error("Failed to get client address.", Error::Kind::GetAddress);
+[[nodiscard]] inline bool PinThread(const int cpu) noexcept {
+  if (cpu < 0 || cpu >= CPU_SETSIZE) {
+    return false;
   }
-  return client_addr;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
 }
+
 }  // namespace tcp
\ No newline at end of file
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "mpmc_queue.h"
+
+namespace tcp {
+
+/**
+ * @brief Bounded lock-free work-stealing deque.
+ *
+ * The owning thread pushes and pops at the bottom, like a stack, while other
+ * threads steal from the top, the oldest end (Chase and Lev's deque). Who
+ * gets an element is decided on the positions alone. Every cell also carries
+ * a sequence number like the cells of MpmcQueue, so the owner never
+ * overwrites a cell a thief is still moving an element out of, and elements
+ * need not be trivially copyable.
+ * @tparam T The element type.
+ */
+template <typename T>
+class WorkStealingDeque {
+ public:
+  /**
+   * @brief Creates a new deque.
+   * @param capacity The minimum capacity, rounded up to a power of two.
+   */
+  [[nodiscard]] explicit WorkStealingDeque(std::size_t capacity)
+      : _mask(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+        _cells(std::make_unique<Cell[]>(_mask + 1)) {
+    for (std::size_t i = 0; i <= _mask; ++i) {
+      _cells[i].seq.store(static_cast<std::int64_t>(i), std::memory_order_relaxed);
+    }
+  }
+
+  WorkStealingDeque(const WorkStealingDeque &) = delete;
+  WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+  /**
+   * @brief Destroys the elements still in the deque.
+   */
+  ~WorkStealingDeque() noexcept {
+    T value;
+    while (TryPop(value)) {
+    }
+  }
+
+  /**
+   * @brief Pushes an element at the bottom if there is room for it. Only
+   * called by the owner.
+   * @param value The element, left untouched if the deque is full.
+   * @return Whether the element was pushed.
+   */
+  [[nodiscard]] bool TryPush(T &&value) noexcept {
+    const std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+    const std::int64_t top = _top.load(std::memory_order_acquire);
+    if (bottom - top > static_cast<std::int64_t>(_mask)) {
+      return false;  // Full
+    }
+
+    // Wait for a thief still moving the element of the previous lap out
+    Cell &cell = _cells[static_cast<std::size_t>(bottom) & _mask];
+    while (cell.seq.load(std::memory_order_acquire) != bottom) {
+      CpuRelax();
+    }
+    ::new (cell.storage) T(std::move(value));
+    cell.seq.store(bottom + 1, std::memory_order_release);
+    _bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Pops the newest element if there is one. Only called by the
+   * owner.
+   * @param value Where to move the element to.
+   * @return Whether an element was popped.
+   */
+  [[nodiscard]] bool TryPop(T &value) noexcept {
+    // Claim the bottom position before looking at the top, so a thief either
+    // sees it claimed or the owner sees the thief's claim
+    const std::int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+    _bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t top = _top.load(std::memory_order_relaxed);
+
+    // Check if the deque was empty
+    if (top > bottom) {
+      _bottom.store(bottom + 1, std::memory_order_relaxed);
+      return false;
+    }
+
+    // The last element goes to whoever moves the top past it first
+    if (top == bottom) {
+      const bool won = _top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+      _bottom.store(bottom + 1, std::memory_order_relaxed);
+      if (!won) {
+        return false;
+      }
+      // The top moved past the position, the cell is next used a lap later
+      Take(bottom, value, bottom + static_cast<std::int64_t>(_mask) + 1);
+      return true;
+    }
+
+    // The owner pushes at the same position next
+    Take(bottom, value, bottom);
+    return true;
+  }
+
+  /**
+   * @brief Steals the oldest element if there is one. Called by any thread
+   * but the owner.
+   * @param value Where to move the element to.
+   * @return Whether an element was stolen, false as well when another thread
+   * got it first.
+   */
+  [[nodiscard]] bool TrySteal(T &value) noexcept {
+    std::int64_t top = _top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t bottom = _bottom.load(std::memory_order_acquire);
+    if (top >= bottom) {
+      return false;  // Empty
+    }
+    if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+      return false;  // Lost the race
+    }
+    // The cell is next used a lap later
+    Take(top, value, top + static_cast<std::int64_t>(_mask) + 1);
+    return true;
+  }
+
+  /**
+   * @brief Returns an estimate of the number of elements in the deque.
+   * @return The approximate size.
+   */
+  [[nodiscard]] std::size_t ApproxSize() const noexcept {
+    const std::int64_t bottom = _bottom.load(std::memory_order_relaxed);
+    const std::int64_t top = _top.load(std::memory_order_relaxed);
+    return bottom > top ? static_cast<std::size_t>(bottom - top) : 0;
+  }
+
+ private:
+  /// @brief A slot of the ring.
+  struct alignas(kCacheLineSize) Cell {
+    /// @brief Position the cell is free for, or that position plus one once
+    /// it holds its element.
+    std::atomic<std::int64_t> seq;
+    /// @brief Storage for the element.
+    alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  /**
+   * @brief Moves the element of a position won by the caller out, and frees
+   * its cell.
+   * @param pos The position.
+   * @param value Where to move the element to.
+   * @param next The position the cell is used for next.
+   */
+  void Take(const std::int64_t pos, T &value, const std::int64_t next) noexcept {
+    Cell &cell = _cells[static_cast<std::size_t>(pos) & _mask];
+    while (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+      CpuRelax();
+    }
+    T *stored = std::launder(reinterpret_cast<T *>(cell.storage));
+    value = std::move(*stored);
+    stored->~T();
+    cell.seq.store(next, std::memory_order_release);
+  }
+
+  /// @brief Mask turning a position into a cell index.
+  std::size_t _mask;
+  /// @brief The cells.
+  std::unique_ptr<Cell[]> _cells;
+  /// @brief Next position to steal from.
+  alignas(kCacheLineSize) std::atomic<std::int64_t> _top{0};
+  /// @brief Next position to push to.
+  alignas(kCacheLineSize) std::atomic<std::int64_t> _bottom{0};
+};
+
+}  // namespace tcp
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <ctime>
+#include <deque>
+#include <span>
+#include <utility>
+
+#include "buffer_pool.h"
+
+namespace tcp {
+
+/**
+ * @brief Outbound data of a connection that the socket did not take yet.
+ *
+ * Responses are queued as chunks, either pooled buffers, views of memory
+ * that outlives the connection or ranges of files, and written with as few
+ * writev calls as possible. File ranges go straight from the page cache to
+ * the socket with sendfile. A partially written chunk stays at the front
+ * until the rest of it goes out. Not thread safe, the owning connection
+ * serializes access.
+ */
+class WriteQueue {
+ public:
+  /// @brief Maximum number of chunks gathered by a single writev.
+  static constexpr std::size_t kMaxIov = 64;
+
+  /// @brief A piece of a response.
+  struct Chunk {
+    /// @brief The buffer owning the bytes, empty for borrowed views and
+    /// files.
+    BufferPool::Buffer owner;
+    /// @brief The bytes to write, unless they come from a file.
+    std::span<const std::byte> view;
+    /// @brief The file to send the bytes from, -1 for bytes in memory. It is
+    /// borrowed, like views are.
+    int file{-1};
+    /// @brief Where the bytes start in the file.
+    off_t file_offset{0};
+    /// @brief The number of bytes to send from the file.
+    std::size_t file_size{0};
+
+    /**
+     * @brief Returns the number of bytes of the chunk.
+     * @return The size of the chunk.
+     */
+    [[nodiscard]] std::size_t size() const noexcept { return file == -1 ? view.size() : file_size; }
+  };
+
+  /// @brief Outcome of a flush.
+  enum class Status {
+    /// @brief Everything was written.
+    Drained,
+    /// @brief The socket is full, the rest waits for the next EPOLLOUT.
+    Pending,
+    /// @brief The socket failed.
+    Failed,
+  };
+
+  /**
+   * @brief Queues a buffer behind the ones already pending. Empty buffers
+   * are dropped right away.
+   * @param buf The buffer.
+   */
+  void Push(BufferPool::Buffer &&buf) {
+    if (!buf->empty()) {
+      const std::span<const std::byte> view(*buf);
+      Push({.owner = std::move(buf), .view = view});
+    }
+  }
+
+  /**
+   * @brief Queues a chunk behind the ones already pending. Empty chunks are
+   * dropped right away.
+   * @param chunk The chunk.
+   */
+  void Push(Chunk &&chunk) {
+    if (chunk.size() > 0) {
+      _bytes += chunk.size();
+      _chunks.push_back(std::move(chunk));
+    }
+  }
+
+  /**
+   * @brief Writes as much of the queue as the socket takes, gathering up to
+   * kMaxIov chunks per call and sending files with sendfile. Written buffers
+   * go back to their pool.
+   *
+   * Borrowed views of at least zerocopy_min bytes are sent on their own with
+   * MSG_ZEROCOPY, so the kernel pins their pages instead of copying them.
+   * Pooled buffers never are, they would be recycled before the kernel is
+   * done with them. The socket needs SO_ZEROCOPY, and its owner must drain
+   * the completions from the socket's error queue.
+   * @param fd The socket.
+   * @param zerocopy_min The size from which views are sent with
+   * MSG_ZEROCOPY, zero to never send them so.
+   * @return The outcome of the flush.
+   */
+  [[nodiscard]] Status Flush(const int fd, const std::size_t zerocopy_min = 0) noexcept {
+    while (!_chunks.empty()) {
+      const Chunk &front = _chunks.front();
+      ssize_t n = -1;
+      if (front.file != -1) {
+        // Send the file from the page cache
+        n = SendFile(fd, front);
+        if (n == 0) {
+          return Status::Failed;  // The file is shorter than queued
+        }
+      } else if (zerocopy_min > 0 && !front.owner && front.view.size() - _offset >= zerocopy_min) {
+        // Pin a large view rather than copying it
+        std::array<iovec, 1> iov{};
+        msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = Gather(iov);
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_ZEROCOPY);
+      } else {
+        // Gather the pending chunks
+        std::array<iovec, kMaxIov> iov{};
+        const std::size_t count = Gather(iov);
+
+        // Write them in one go, like writev but without raising SIGPIPE when
+        // the client is gone
+        msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = count;
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      }
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK ? Status::Pending : Status::Failed;
+      }
+
+      // Release what went out, and remember where the rest starts
+      Consume(static_cast<std::size_t>(n));
+    }
+    return Status::Drained;
+  }
+
+  /**
+   * @brief Drops the MSG_ZEROCOPY completions queued on a socket's error
+   * queue, which keep it reporting EPOLLERR. Views outlive the connection, so
+   * there is nothing to release once the kernel is done with them.
+   * @param fd The socket.
+   */
+  static void ReapZerocopy(const int fd) noexcept {
+    alignas(cmsghdr) char control[128];
+    msghdr msg{};
+    while (true) {
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1 && errno != EINTR) {
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief Describes the oldest pending bytes, for writing them elsewhere
+   * than in Flush. The chunks stay put until they are consumed, even if more
+   * are pushed in the meantime. Stops at the first file, see LoadFile.
+   * @param iov Where to describe them, at most one chunk per entry.
+   * @return The number of entries filled in.
+   */
+  std::size_t Gather(std::span<iovec> iov) const noexcept {
+    std::size_t count = 0;
+    for (auto it = _chunks.begin(); it != _chunks.end() && it->file == -1 && count < iov.size(); ++it, ++count) {
+      const std::span<const std::byte> rest = it->view.subspan(count == 0 ? _offset : 0);
+      iov[count] = {.iov_base = const_cast<std::byte *>(rest.data()), .iov_len = rest.size()};
+    }
+    return count;
+  }
+
+  /**
+   * @brief Drops bytes that were written, releasing the chunks that are done.
+   * @param written The number of bytes written, from the oldest ones.
+   */
+  void Consume(std::size_t written) noexcept {
+    _bytes -= written;
+    while (written > 0) {
+      const std::size_t left = _chunks.front().size() - _offset;
+      if (written < left) {
+        _offset += written;
+        break;
+      }
+      written -= left;
+      _offset = 0;
+      _chunks.pop_front();
+    }
+  }
+
+  /**
+   * @brief Reads the next bytes of the file at the front of the queue, if
+   * any, into a pooled buffer queued in their place. For writers that only
+   * take bytes in memory, a buffer's worth at a time.
+   * @param pool The pool to borrow the buffer from.
+   * @return Whether the front of the queue is in memory, false if the file
+   * could not be read.
+   */
+  [[nodiscard]] bool LoadFile(BufferPool &pool) {
+    if (_chunks.empty() || _chunks.front().file == -1) {
+      return true;
+    }
+
+    // Read past what was already written
+    Chunk &front = _chunks.front();
+    BufferPool::Buffer buf = pool.AcquireEmpty();
+    buf->resize(std::min(pool.buf_size(), front.file_size - _offset));
+    ssize_t n = -1;
+    do {
+      n = pread(front.file, buf->data(), buf->size(), front.file_offset + static_cast<off_t>(_offset));
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) {
+      return false;
+    }
+    buf->resize(static_cast<std::size_t>(n));
+
+    // The rest of the file stays queued behind the bytes read
+    front.file_offset += static_cast<off_t>(_offset) + n;
+    front.file_size -= _offset + static_cast<std::size_t>(n);
+    _offset = 0;
+    if (front.file_size == 0) {
+      _chunks.pop_front();
+    }
+    const std::span<const std::byte> view(*buf);
+    _chunks.push_front({.owner = std::move(buf), .view = view});
+    return true;
+  }
+
+  /**
+   * @brief Drops everything that is pending.
+   */
+  void Clear() noexcept {
+    _chunks.clear();
+    _offset = 0;
+    _bytes = 0;
+  }
+
+  /**
+   * @brief Returns whether nothing is pending.
+   * @return Whether the queue is empty.
+   */
+  [[nodiscard]] bool empty() const noexcept { return _chunks.empty(); }
+
+  /**
+   * @brief Returns the number of bytes pending.
+   * @return The number of bytes pending.
+   */
+  [[nodiscard]] std::size_t bytes() const noexcept { return _bytes; }
+
+ private:
+  /**
+   * @brief Sends what is left of a file chunk with sendfile.
+   * @param fd The socket.
+   * @param chunk The front chunk.
+   * @return What sendfile returned.
+   */
+  [[nodiscard]] ssize_t SendFile(const int fd, const Chunk &chunk) const noexcept {
+    IgnoreSigpipe();
+    off_t offset = chunk.file_offset + static_cast<off_t>(_offset);
+    return sendfile(fd, chunk.file, &offset, chunk.file_size - _offset);
+  }
+
+  /**
+   * @brief Ignores SIGPIPE process-wide, unless the application handles it,
+   * since sendfile has no MSG_NOSIGNAL. Done once, by the first file chunk
+   * sent, so sending costs no extra syscalls.
+   */
+  static void IgnoreSigpipe() noexcept {
+    [[maybe_unused]] static const bool ignored = [] {
+      struct sigaction action {};
+      if (sigaction(SIGPIPE, nullptr, &action) == -1 || action.sa_handler != SIG_DFL) {
+        return false;
+      }
+      action = {};
+      action.sa_handler = SIG_IGN;
+      return sigaction(SIGPIPE, &action, nullptr) == 0;
+    }();
+  }
+
+  /// @brief The pending chunks, oldest first.
+  std::deque<Chunk> _chunks;
+  /// @brief Bytes of the front chunk that were already written.
+  std::size_t _offset{0};
+  /// @brief Total number of bytes pending.
+  std::size_t _bytes{0};
+};
+
+}  // namespace tcp
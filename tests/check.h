@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+/// @brief Number of checks that failed so far in the test program.
+inline int failed_checks = 0;
+
+/**
+ * @brief Checks a condition, reporting it and carrying on if it does not
+ * hold. Unlike assert, it is kept in release builds.
+ */
+#define CHECK(condition)                                                              \
+  do {                                                                                \
+    if (!(condition)) {                                                               \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+      ++failed_checks;                                                                \
+    }                                                                                 \
+  } while (false)
+
+/**
+ * @brief Returns the exit status of the test program.
+ * @return EXIT_SUCCESS if every check held.
+ */
+[[nodiscard]] inline int TestResult() noexcept { return failed_checks == 0 ? EXIT_SUCCESS : EXIT_FAILURE; }
@@ -0,0 +1,108 @@
+#include <tcp/framing.h>
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+
+/**
+ * @brief Returns the bytes of a text.
+ * @param text The text.
+ * @return The bytes.
+ */
+std::vector<std::byte> Bytes(const std::string_view text) {
+  std::vector<std::byte> bytes(text.size());
+  for (std::size_t i = 0; i < text.size(); ++i) {
+    bytes[i] = static_cast<std::byte>(text[i]);
+  }
+  return bytes;
+}
+
+/**
+ * @brief Length prefixed frames need their whole header and payload, and
+ * payloads over the limit are invalid.
+ */
+void TestLengthPrefix() {
+  using Framing = tcp::LengthPrefixFraming<2, 4>;
+  static_assert(tcp::FramingPolicy<Framing>);
+
+  const std::vector<std::byte> frame = Bytes(std::string_view("\x00\x03" "abc" "\x00", 6));
+  CHECK(Framing::FrameSize({}) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(std::span(frame).first(1)) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(std::span(frame).first(4)) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(std::span(frame).first(5)) == 5);
+  CHECK(Framing::FrameSize(frame) == 5);
+  CHECK(Framing::Payload(std::span(frame).first(5)).size() == 3);
+  CHECK(Framing::Payload(std::span(frame).first(5))[0] == std::byte{'a'});
+
+  // An empty payload is a frame of its own
+  const std::vector<std::byte> empty = Bytes(std::string_view("\x00\x00", 2));
+  CHECK(Framing::FrameSize(empty) == 2);
+  CHECK(Framing::Payload(empty).empty());
+
+  // The limit is checked from the header, before the payload arrives
+  const std::vector<std::byte> largest = Bytes(std::string_view("\x00\x04", 2));
+  const std::vector<std::byte> too_large = Bytes(std::string_view("\x00\x05", 2));
+  const std::vector<std::byte> huge = Bytes(std::string_view("\xff\xff", 2));
+  CHECK(Framing::FrameSize(largest) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(too_large) == tcp::kInvalidFrame);
+  CHECK(Framing::FrameSize(huge) == tcp::kInvalidFrame);
+}
+
+/**
+ * @brief Delimited frames end at the first delimiter, and streams going
+ * longer than the limit without one are invalid.
+ */
+void TestDelimiter() {
+  using Framing = tcp::DelimiterFraming<'\n', 4>;
+  static_assert(tcp::FramingPolicy<Framing>);
+
+  CHECK(Framing::FrameSize({}) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(Bytes("abc")) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(Bytes("abc\ndef\n")) == 4);
+  CHECK(Framing::FrameSize(Bytes("\n")) == 1);
+  CHECK(Framing::Payload(Bytes("\n")).empty());
+  CHECK(Framing::Payload(Bytes("ab\n")).size() == 2);
+
+  // The largest payload still fits, one more byte does not
+  CHECK(Framing::FrameSize(Bytes("abcd")) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(Bytes("abcd\n")) == 5);
+  CHECK(Framing::FrameSize(Bytes("abcde")) == tcp::kInvalidFrame);
+  CHECK(Framing::FrameSize(Bytes("abcde\n")) == tcp::kInvalidFrame);
+}
+
+/**
+ * @brief Fixed size frames are complete once that many bytes arrived.
+ */
+void TestFixedSize() {
+  using Framing = tcp::FixedSizeFraming<3>;
+  static_assert(tcp::FramingPolicy<Framing>);
+
+  CHECK(Framing::FrameSize({}) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(Bytes("ab")) == tcp::kIncompleteFrame);
+  CHECK(Framing::FrameSize(Bytes("abc")) == 3);
+  CHECK(Framing::FrameSize(Bytes("abcde")) == 3);
+}
+
+/**
+ * @brief Raw framing hands everything over, and nothing is no frame.
+ */
+void TestRaw() {
+  static_assert(tcp::FramingPolicy<tcp::RawFraming>);
+
+  CHECK(tcp::RawFraming::FrameSize({}) == tcp::kIncompleteFrame);
+  CHECK(tcp::RawFraming::FrameSize(Bytes("abc")) == 3);
+}
+
+}  // namespace
+
+int main() {
+  TestLengthPrefix();
+  TestDelimiter();
+  TestFixedSize();
+  TestRaw();
+  return TestResult();
+}
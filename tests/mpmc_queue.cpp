@@ -0,0 +1,135 @@
+#include <tcp/mpmc_queue.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+
+/**
+ * @brief Capacities are rounded up to a power of two, two at least.
+ */
+void TestCapacity() {
+  CHECK(tcp::MpmcQueue<int>(0).capacity() == 2);
+  CHECK(tcp::MpmcQueue<int>(5).capacity() == 8);
+  CHECK(tcp::MpmcQueue<int>(8).capacity() == 8);
+}
+
+/**
+ * @brief An empty queue pops nothing, a full one refuses pushes and leaves
+ * the element alone.
+ */
+void TestEmptyAndFull() {
+  tcp::MpmcQueue<std::unique_ptr<int>> queue(4);
+  std::unique_ptr<int> out;
+  CHECK(!queue.TryPop(out));
+
+  for (int i = 0; i < 4; ++i) {
+    CHECK(queue.TryPush(std::make_unique<int>(i)));
+  }
+  auto extra = std::make_unique<int>(4);
+  CHECK(!queue.TryPush(std::move(extra)));
+  CHECK(extra != nullptr && *extra == 4);
+  CHECK(queue.ApproxSize() == 4);
+
+  for (int i = 0; i < 4; ++i) {
+    CHECK(queue.TryPop(out) && *out == i);
+  }
+  CHECK(!queue.TryPop(out));
+  CHECK(queue.ApproxSize() == 0);
+}
+
+/**
+ * @brief Elements keep their order across many laps of the ring, with the
+ * positions wrapping around the cells at every fill level.
+ */
+void TestWraparound() {
+  tcp::MpmcQueue<int> queue(8);
+  int next_push = 0;
+  int next_pop = 0;
+  for (int lap = 0; lap < 1000; ++lap) {
+    const int burst = 1 + lap % 8;
+    for (int i = 0; i < burst; ++i) {
+      CHECK(queue.TryPush(int{next_push++}));
+    }
+    for (int i = 0; i < burst; ++i) {
+      int out = -1;
+      CHECK(queue.TryPop(out) && out == next_pop);
+      ++next_pop;
+    }
+  }
+  int out = -1;
+  CHECK(!queue.TryPop(out));
+}
+
+/**
+ * @brief Elements left in the queue are destroyed with it.
+ */
+void TestDestroysLeftovers() {
+  const auto tracker = std::make_shared<int>(0);
+  {
+    tcp::MpmcQueue<std::shared_ptr<int>> queue(4);
+    CHECK(queue.TryPush(std::shared_ptr<int>(tracker)));
+    CHECK(queue.TryPush(std::shared_ptr<int>(tracker)));
+    CHECK(tracker.use_count() == 3);
+  }
+  CHECK(tracker.use_count() == 1);
+}
+
+/**
+ * @brief Every element pushed by concurrent producers is popped exactly once
+ * by concurrent consumers.
+ */
+void TestConcurrent() {
+  constexpr std::size_t kThreads = 4;
+  constexpr std::size_t kPerProducer = 100000;
+  tcp::MpmcQueue<std::size_t> queue(64);
+  std::vector<std::atomic<int>> seen(kThreads * kPerProducer);
+  std::atomic<std::size_t> popped{0};
+
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&queue, t] {
+      for (std::size_t i = 0; i < kPerProducer; ++i) {
+        while (!queue.TryPush(t * kPerProducer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    threads.emplace_back([&] {
+      std::size_t value = 0;
+      while (popped.load() < kThreads * kPerProducer) {
+        if (queue.TryPop(value)) {
+          seen[value].fetch_add(1);
+          popped.fetch_add(1);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  bool once = true;
+  for (const std::atomic<int> &count : seen) {
+    once = once && count.load() == 1;
+  }
+  CHECK(once);
+}
+
+}  // namespace
+
+int main() {
+  TestCapacity();
+  TestEmptyAndFull();
+  TestWraparound();
+  TestDestroysLeftovers();
+  TestConcurrent();
+  return TestResult();
+}
@@ -0,0 +1,89 @@
+#include <tcp/rate_limit.h>
+
+#include <chrono>
+
+#include "check.h"
+
+namespace {
+
+using Clock = tcp::TokenBucket::Clock;
+using std::chrono::milliseconds;
+
+/**
+ * @brief Takes every token available at a time.
+ * @param bucket The bucket.
+ * @param now The time.
+ * @return The number of tokens taken.
+ */
+int Drain(tcp::TokenBucket &bucket, const Clock::time_point now) {
+  int taken = 0;
+  while (taken < 1000 && bucket.Ready(now)) {
+    bucket.Take();
+    ++taken;
+  }
+  return taken;
+}
+
+/**
+ * @brief A new bucket is full, and holds at least one token.
+ */
+void TestBurst() {
+  const Clock::time_point start{};
+  tcp::TokenBucket bucket(4, 3, start);
+  CHECK(Drain(bucket, start) == 3);
+
+  tcp::TokenBucket tiny(4, 0.25, start);
+  CHECK(Drain(tiny, start) == 1);
+}
+
+/**
+ * @brief Tokens come back at the rate, fractions of them add up, and the
+ * bucket never holds more than the burst.
+ */
+void TestRefill() {
+  const Clock::time_point start{};
+  tcp::TokenBucket bucket(4, 3, start);
+  CHECK(Drain(bucket, start) == 3);
+
+  // A token every quarter of a second, built up from halves
+  CHECK(Drain(bucket, start + milliseconds(125)) == 0);
+  CHECK(Drain(bucket, start + milliseconds(250)) == 1);
+  CHECK(Drain(bucket, start + milliseconds(375)) == 0);
+  CHECK(Drain(bucket, start + milliseconds(1000)) == 3);
+
+  // Idle for long, the bucket only fills up to the burst
+  CHECK(Drain(bucket, start + milliseconds(60000)) == 3);
+}
+
+/**
+ * @brief Time points earlier than the last one add no tokens.
+ */
+void TestClockGoingBack() {
+  const Clock::time_point start{milliseconds(10000)};
+  tcp::TokenBucket bucket(4, 1, start);
+  CHECK(Drain(bucket, start) == 1);
+  CHECK(Drain(bucket, start - milliseconds(5000)) == 0);
+  CHECK(Drain(bucket, start + milliseconds(250)) == 1);
+}
+
+/**
+ * @brief Buckets of rate zero, default ones included, never run out.
+ */
+void TestUnlimited() {
+  const Clock::time_point start{};
+  tcp::TokenBucket bucket(0, 1, start);
+  CHECK(Drain(bucket, start) == 1000);
+
+  tcp::TokenBucket unlimited;
+  CHECK(Drain(unlimited, start) == 1000);
+}
+
+}  // namespace
+
+int main() {
+  TestBurst();
+  TestRefill();
+  TestClockGoingBack();
+  TestUnlimited();
+  return TestResult();
+}
@@ -0,0 +1,139 @@
+#include <tcp/timer_wheel.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+
+using Node = tcp::TimerWheel::Node;
+
+/**
+ * @brief Schedules timers on either side of the slot boundaries of every
+ * level from a start tick, and checks every one expires exactly on time as
+ * the wheel moves forward to its NextExpiry, as the reactors do.
+ * @param start The tick the wheel starts at.
+ */
+void CheckExpiresOnTime(const std::uint64_t start) {
+  tcp::TimerWheel wheel;
+  wheel.Advance(start, [](Node &) {});
+  CHECK(wheel.now() == start);
+
+  std::vector<std::uint64_t> expiries;
+  for (const std::uint64_t boundary : {std::uint64_t{1} << 6, std::uint64_t{1} << 12, std::uint64_t{1} << 18,
+                                       std::uint64_t{1} << 24}) {
+    // As far as the boundary from the start, and around the next multiple
+    // of the boundary, where the timers move down a level
+    const std::uint64_t multiple = (start / boundary + 1) * boundary;
+    for (const std::uint64_t expiry : {start + boundary - 1, start + boundary, start + boundary + 1, multiple - 1,
+                                       multiple, multiple + 1}) {
+      if (expiry > start) {
+        expiries.push_back(expiry);
+      }
+    }
+  }
+  expiries.push_back(start + 1);
+  expiries.push_back(start + (std::uint64_t{1} << 24) + 12345);
+
+  std::vector<Node> nodes(expiries.size());
+  std::vector<std::uint64_t> expired_at(expiries.size(), 0);
+  std::uint64_t last = start;
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    wheel.Schedule(nodes[i], expiries[i]);
+    last = expiries[i] > last ? expiries[i] : last;
+  }
+  CHECK(wheel.size() == nodes.size());
+
+  while (wheel.size() > 0 && wheel.now() <= last) {
+    // The wheel must be woken up no later than the next timer is due
+    std::uint64_t next = tcp::TimerWheel::kNever;
+    for (std::size_t i = 0; i < nodes.size(); ++i) {
+      if (nodes[i].scheduled() && expiries[i] < next) {
+        next = expiries[i];
+      }
+    }
+    CHECK(wheel.NextExpiry() <= next);
+
+    wheel.Advance(wheel.NextExpiry(), [&](Node &node) {
+      CHECK(!node.scheduled());
+      expired_at[static_cast<std::size_t>(&node - nodes.data())] = wheel.now();
+    });
+  }
+  CHECK(wheel.size() == 0);
+  CHECK(wheel.NextExpiry() == tcp::TimerWheel::kNever);
+
+  bool on_time = true;
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    on_time = on_time && expired_at[i] == expiries[i];
+  }
+  CHECK(on_time);
+}
+
+/**
+ * @brief Cancelled timers never expire, rescheduled ones expire at their
+ * new tick, and timers due already expire on the next tick.
+ */
+void TestScheduleAndCancel() {
+  tcp::TimerWheel wheel;
+  Node cancelled;
+  Node moved;
+  Node overdue;
+  wheel.Schedule(cancelled, 100);
+  wheel.Schedule(moved, 5000);
+  wheel.Schedule(moved, 70);
+  wheel.Cancel(cancelled);
+  wheel.Cancel(cancelled);
+  CHECK(!cancelled.scheduled());
+  CHECK(wheel.size() == 1);
+
+  std::vector<std::uint64_t> expired;
+  wheel.Advance(65, [&](Node &) { expired.push_back(wheel.now()); });
+  wheel.Schedule(overdue, 10);
+  wheel.Advance(200, [&](Node &) { expired.push_back(wheel.now()); });
+  CHECK(expired.size() == 2);
+  CHECK(expired.size() == 2 && expired[0] == 66 && expired[1] == 70);
+}
+
+/**
+ * @brief A timer scheduled again from its callback expires once per period.
+ */
+void TestRescheduleFromCallback() {
+  tcp::TimerWheel wheel;
+  Node periodic;
+  std::vector<std::uint64_t> expired;
+  wheel.Schedule(periodic, 64);
+  wheel.Advance(64 * 5, [&](Node &node) {
+    expired.push_back(wheel.now());
+    wheel.Schedule(node, wheel.now() + 64);
+  });
+  CHECK(expired.size() == 5);
+  CHECK(expired.size() == 5 && expired.front() == 64 && expired.back() == 64 * 5);
+  CHECK(periodic.scheduled());
+}
+
+/**
+ * @brief An empty wheel jumps straight to the tick it is moved to.
+ */
+void TestEmptyWheel() {
+  tcp::TimerWheel wheel;
+  CHECK(wheel.NextExpiry() == tcp::TimerWheel::kNever);
+  wheel.Advance(std::uint64_t{1} << 40, [](Node &) {});
+  CHECK(wheel.now() == std::uint64_t{1} << 40);
+  wheel.Advance(5, [](Node &) {});
+  CHECK(wheel.now() == std::uint64_t{1} << 40);
+}
+
+}  // namespace
+
+int main() {
+  CheckExpiresOnTime(0);
+  CheckExpiresOnTime(63);
+  CheckExpiresOnTime((std::uint64_t{1} << 18) - 1);
+  CheckExpiresOnTime((std::uint64_t{1} << 30) + 12345);
+  TestScheduleAndCancel();
+  TestRescheduleFromCallback();
+  TestEmptyWheel();
+  return TestResult();
+}
@@ -0,0 +1,163 @@
+#include <tcp/work_stealing_deque.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+
+namespace {
+
+/**
+ * @brief The owner pops the newest element, thieves steal the oldest, and a
+ * full deque refuses pushes.
+ */
+void TestEnds() {
+  tcp::WorkStealingDeque<std::unique_ptr<int>> deque(4);
+  std::unique_ptr<int> out;
+  CHECK(!deque.TryPop(out));
+  CHECK(!deque.TrySteal(out));
+
+  for (int i = 0; i < 4; ++i) {
+    CHECK(deque.TryPush(std::make_unique<int>(i)));
+  }
+  auto extra = std::make_unique<int>(4);
+  CHECK(!deque.TryPush(std::move(extra)));
+  CHECK(extra != nullptr && *extra == 4);
+  CHECK(deque.ApproxSize() == 4);
+
+  CHECK(deque.TryPop(out) && *out == 3);
+  CHECK(deque.TrySteal(out) && *out == 0);
+  CHECK(deque.TryPop(out) && *out == 2);
+  CHECK(deque.TrySteal(out) && *out == 1);
+  CHECK(!deque.TryPop(out));
+  CHECK(!deque.TrySteal(out));
+  CHECK(deque.ApproxSize() == 0);
+}
+
+/**
+ * @brief The last element goes to either the owner or a thief, and the
+ * deque keeps working after either.
+ */
+void TestLastElement() {
+  tcp::WorkStealingDeque<int> deque(2);
+  int out = -1;
+
+  CHECK(deque.TryPush(1));
+  CHECK(deque.TryPop(out) && out == 1);
+  CHECK(!deque.TrySteal(out));
+
+  CHECK(deque.TryPush(2));
+  CHECK(deque.TrySteal(out) && out == 2);
+  CHECK(!deque.TryPop(out));
+
+  // Both ends were used on the last element, the positions still line up
+  CHECK(deque.TryPush(3));
+  CHECK(deque.TryPush(4));
+  CHECK(!deque.TryPush(5));
+  CHECK(deque.TrySteal(out) && out == 3);
+  CHECK(deque.TryPop(out) && out == 4);
+  CHECK(deque.ApproxSize() == 0);
+}
+
+/**
+ * @brief Elements keep their order across many laps of the ring, pushed at
+ * the bottom and stolen from the top.
+ */
+void TestWraparound() {
+  tcp::WorkStealingDeque<int> deque(8);
+  int next_push = 0;
+  int next_steal = 0;
+  for (int lap = 0; lap < 1000; ++lap) {
+    const int burst = 1 + lap % 8;
+    for (int i = 0; i < burst; ++i) {
+      CHECK(deque.TryPush(int{next_push++}));
+    }
+    for (int i = 0; i < burst; ++i) {
+      int out = -1;
+      CHECK(deque.TrySteal(out) && out == next_steal);
+      ++next_steal;
+    }
+  }
+}
+
+/**
+ * @brief Elements left in the deque are destroyed with it.
+ */
+void TestDestroysLeftovers() {
+  const auto tracker = std::make_shared<int>(0);
+  {
+    tcp::WorkStealingDeque<std::shared_ptr<int>> deque(4);
+    CHECK(deque.TryPush(std::shared_ptr<int>(tracker)));
+    CHECK(deque.TryPush(std::shared_ptr<int>(tracker)));
+    CHECK(tracker.use_count() == 3);
+  }
+  CHECK(tracker.use_count() == 1);
+}
+
+/**
+ * @brief The owner races thieves for the last element over and over, then
+ * for longer runs, and every element is taken exactly once.
+ */
+void TestRaces() {
+  constexpr std::size_t kThieves = 3;
+  constexpr std::size_t kRounds = 100000;
+  constexpr std::size_t kRun = 16;
+  tcp::WorkStealingDeque<std::size_t> deque(kRun);
+  std::vector<std::atomic<int>> taken(kRounds * 2);
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> thieves;
+  for (std::size_t t = 0; t < kThieves; ++t) {
+    thieves.emplace_back([&] {
+      std::size_t value = 0;
+      while (!done.load()) {
+        if (deque.TrySteal(value)) {
+          taken[value].fetch_add(1);
+        }
+      }
+    });
+  }
+
+  std::size_t value = 0;
+  for (std::size_t round = 0; round < kRounds; ++round) {
+    // A single element, so every pop races the thieves for the last one
+    CHECK(deque.TryPush(std::size_t{round}));
+    if (deque.TryPop(value)) {
+      taken[value].fetch_add(1);
+    }
+  }
+  for (std::size_t round = kRounds; round < kRounds * 2; round += kRun) {
+    for (std::size_t i = 0; i < kRun; ++i) {
+      CHECK(deque.TryPush(round + i));
+    }
+    while (deque.TryPop(value)) {
+      taken[value].fetch_add(1);
+    }
+  }
+
+  // The deque is empty, thieves finish the element they may be moving out
+  done.store(true);
+  for (std::thread &thief : thieves) {
+    thief.join();
+  }
+
+  bool once = true;
+  for (const std::atomic<int> &count : taken) {
+    once = once && count.load() == 1;
+  }
+  CHECK(once);
+}
+
+}  // namespace
+
+int main() {
+  TestEnds();
+  TestLastElement();
+  TestWraparound();
+  TestDestroysLeftovers();
+  TestRaces();
+  return TestResult();
+}